@@ -0,0 +1,455 @@
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <sys/resource.h>
+#include <QGuiApplication>
+#include <QImage>
+#include <QString>
+#include <QDir>
+#include <QFile>
+#include "palette.h"
+#include "quantize.h"
+#include "histogram.h"
+#include "palbundle.h"
+#include "bufpool.h"
+#include "dkm.hpp"
+
+/*
+ * manpal-bench [-o results.json] [-t min_seconds] [filter]
+ * manpal-bench --golden-record DIR | --golden-check DIR
+ * manpal-bench --pool-check
+ * manpal-bench --map-check
+ *
+ * Every case is repeated until it has run for at least min_seconds,
+ * the fastest repetition is reported. Results go to stdout as a table
+ * and optionally as JSON (one object per case) for comparing releases.
+ */
+
+struct Result {
+    std::string name, input;
+    long long items; // pixels or points processed per repetition
+    int reps;
+    double best_ns;
+    long peak_rss_kb;
+};
+
+int golden(QString const &dir, bool record); // golden.cpp
+
+static std::vector<Result> results;
+static double min_time = 0.3;
+static const char *filter_str = nullptr;
+
+static long peak_rss_kb()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+template<typename F>
+static void run(std::string const &name, std::string const &input, long long items, F f)
+{
+    std::string full = name + " " + input;
+    if (filter_str && !strstr(full.c_str(), filter_str)) return;
+
+    typedef std::chrono::steady_clock clk;
+    double best = 1e300, total = 0;
+    int reps = 0;
+    do {
+        auto t0 = clk::now();
+        f();
+        double ns = std::chrono::duration<double, std::nano>(clk::now() - t0).count();
+        best = std::min(best, ns);
+        total += ns;
+        ++reps;
+    } while (total < min_time * 1e9 || reps < 3);
+
+    Result r = {name, input, items, reps, best, peak_rss_kb()};
+    results.push_back(r);
+    printf("%-28s %-20s %10.2f ns/item %10.2f Mitem/s %8.3f ms %6ld MB\n",
+        name.c_str(), input.c_str(), best / items, items / best * 1e3,
+        best * 1e-6, r.peak_rss_kb >> 10);
+    fflush(stdout);
+}
+
+static void write_json(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return;
+    }
+    fprintf(f, "[\n");
+    for( size_t i=0; i<results.size(); ++i ) {
+        auto const &r = results[i];
+        fprintf(f, "  {\"name\": \"%s\", \"input\": \"%s\", \"items\": %lld, \"reps\": %d, "
+            "\"best_ns\": %.0f, \"ns_per_item\": %.4f, \"items_per_s\": %.1f, \"peak_rss_kb\": %ld}%s\n",
+            r.name.c_str(), r.input.c_str(), r.items, r.reps, r.best_ns,
+            r.best_ns / r.items, r.items / r.best_ns * 1e9, r.peak_rss_kb,
+            i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]\n");
+    fclose(f);
+}
+
+// evenly spaced grays, like genGray in the GUI
+static Palette gray_palette(int n)
+{
+    std::vector<uint32_t> c(n);
+    for( int i=0; i<n; ++i ) {
+        int v = n > 1 ? i * 255 / (n-1) : 0;
+        c[i] = v * 0x010101;
+    }
+    return Palette(c.data(), n);
+}
+
+// a fixed LCG, so every standard library gives the same colors
+static Palette random_palette(int n, unsigned seed)
+{
+    uint32_t s = seed;
+    std::vector<uint32_t> c(n);
+    for( auto &x : c ) {
+        s = s * 1664525u + 1013904223u;
+        x = s >> 8;
+    }
+    return Palette(c.data(), n);
+}
+
+// n steps from c0 to c1, even in linear light, so the entries lie on a line
+// up to rounding. jitter moves every channel by up to that many 8 bit steps
+static Palette duotone_palette(int n, uint32_t c0, uint32_t c1, int jitter=0)
+{
+    uint32_t s = 1;
+    std::vector<uint32_t> c(n);
+    for( int i=0; i<n; ++i ) {
+        c[i] = 0;
+        for( int sh=16; sh>=0; sh-=8 ) {
+            int a = sRGBtoL((c0 >> sh & 0xff) * 0x7fff / 255), b = sRGBtoL((c1 >> sh & 0xff) * 0x7fff / 255);
+            int v = ( LtosRGB(a + (b - a) * i / std::max(n-1, 1)) * 255 + 0x3fff ) / 0x7fff;
+            if (jitter) {
+                s = s * 1664525u + 1013904223u;
+                v += (int) (s >> 16) % (2*jitter + 1) - jitter;
+            }
+            c[i] |= std::min(std::max(v, 0), 255) << sh;
+        }
+    }
+    return Palette(c.data(), n);
+}
+
+static std::vector<std::array<float,3>> points(QImage const &img)
+{
+    std::vector<std::array<float,3>> data;
+    QImage p = img.convertToFormat(QImage::Format_RGB32);
+    data.reserve(p.width() * p.height());
+    for( int y=0; y<p.height(); ++y ) {
+        auto s = (QRgb const*) p.constScanLine(y);
+        for( int x=0; x<p.width(); ++x )
+            data.push_back({{(float) qRed(s[x]), (float) qGreen(s[x]), (float) qBlue(s[x])}});
+    }
+    return data;
+}
+
+static std::vector<std::array<uint8_t,3>> points8(std::vector<std::array<float,3>> const &f)
+{
+    std::vector<std::array<uint8_t,3>> data;
+    for( auto const &p : f )
+        data.push_back({{(uint8_t) p[0], (uint8_t) p[1], (uint8_t) p[2]}});
+    return data;
+}
+
+static std::string dims(QImage const &i, const char *name)
+{
+    return std::string(name) + "@" + std::to_string(i.width()) + "x" + std::to_string(i.height());
+}
+
+static QImage gradient(int w, int h)
+{
+    QImage src(w, h, QImage::Format_RGB32);
+    for( int y=0; y<h; ++y ) {
+        QRgb *d = (QRgb*) src.scanLine(y);
+        for( int x=0; x<w; ++x )
+            d[x] = qRgb(x * 255 / w, y * 255 / h, ( x + y ) & 255);
+    }
+    return src;
+}
+
+/*
+ * The preview path while a window is dragged wider and back: every frame
+ * quantizes at a new size through one BufferPool and keeps the previous
+ * output alive, like the view does. The pool has to stay within a few
+ * frames of the current size instead of keeping every size it saw.
+ * Then the sizes stop changing, with full resolution jobs in between like
+ * the window runs them, in a pool of their own. Once each kind of job ran
+ * neither pool may allocate again
+ */
+static int pool_check()
+{
+    BufferPool pool, job_pool;
+    QuantizerContext ctx;
+    ctx.pal = random_palette(16, 1);
+    ctx.pool = &pool;
+    QImage shown;
+    size_t worst = 0;
+    int failed = 0;
+    for( int step=0; step<400; ++step ) {
+        int w = 200 + 5 * ( step < 200 ? step : 400 - step ), h = w * 3 / 4;
+        shown = quantizeImg(ctx, gradient(w, h), 1);
+        size_t limit = 6 * (size_t) ( ( w + 3 ) & ~3 ) * h + 256 * w;
+        size_t held = pool.allocated();
+        worst = std::max(worst, held);
+        if (held > limit) {
+            if (!failed++) printf("%dx%d: pool holds %zu bytes, limit %zu\n", w, h, held, limit);
+        }
+    }
+    printf("pool check: largest %zu bytes, %s\n", worst, failed ? "FAILED" : "ok");
+
+    // the preview, then comparing all methods or saving
+    ThreadPool workers;
+    QuantizerContext job = ctx;
+    job.pool = &job_pool;
+    QImage view = gradient(640, 480), full = gradient(1280, 960), saved;
+    std::vector<MethodResult> compared;
+    size_t warm = 0, warm_job = 0;
+    for( int round=0; round<12; ++round ) {
+        shown = quantizeImg(ctx, view, 1);
+        if (round % 2) saved = quantizeImg(job, full, 1);
+        else compared = quantizeAll(workers, job, full);
+        if (round == 3) {
+            // both jobs ran twice. a job runs while the results of the one
+            // before are still shown, so it takes two sets of buffers
+            warm = pool.allocations();
+            warm_job = job_pool.allocations();
+        }
+    }
+    size_t more = pool.allocations() - warm, more_job = job_pool.allocations() - warm_job;
+    printf("pool check: %zu + %zu allocations after warm-up, %s\n", more, more_job, more || more_job ? "FAILED" : "ok");
+    failed += more || more_job;
+    return failed ? 1 : 0;
+}
+
+// the nearest entry by a plain search over every entry, the lowest index
+// winning a tie. what Palette::map has to return, whichever search it uses
+static int nearest(Palette const &pal, ivec3 c)
+{
+    long best = LONG_MAX;
+    int bi = 0;
+    for( int i=0; i<pal.n; ++i ) {
+        long r = 0;
+        for( int k=0; k<3; ++k ) {
+            long d = pal.lin[i].s[k] - c.s[k];
+            r += d * d;
+        }
+        if (r < best) {
+            best = r;
+            bi = i;
+        }
+    }
+    return bi;
+}
+
+/*
+ * The line search and the gray table against the plain search: every gray
+ * level, a grid over the color cube and random colors, on palettes that
+ * take the fast paths
+ */
+static int map_check()
+{
+    struct { const char *name; Palette pal; } pals[] = {
+        {"gray32", gray_palette(32)},
+        {"gray256", gray_palette(256)},
+        {"duotone48", duotone_palette(48, 0x102050, 0xf0e0a0)},
+        {"duotone256", duotone_palette(256, 0x000000, 0xffc080)},
+        {"duotone64-jitter", duotone_palette(64, 0x301000, 0xa0f0ff, 1)},
+    };
+    std::vector<ivec3> probe;
+    for( int v=0; v<0x8000; ++v )
+        probe.push_back(ivec3(v));
+    for( int r=0; r<=0x7fff; r+=0x3ff )
+        for( int g=0; g<=0x7fff; g+=0x3ff )
+            for( int b=0; b<=0x7fff; b+=0x3ff )
+                probe.push_back(ivec3(r, g, b));
+    uint32_t s = 1;
+    for( int i=0; i<1<<18; ++i ) {
+        int c[3];
+        for( int &x : c ) {
+            s = s * 1664525u + 1013904223u;
+            x = s >> 17;
+        }
+        probe.push_back(ivec3(c[0], c[1], c[2]));
+    }
+
+    int failed = 0;
+    for( auto const &p : pals ) {
+        long bad = 0;
+        for( auto c : probe )
+            bad += p.pal.map(c) != nearest(p.pal, c);
+        if (p.pal.gray)
+            for( int v=0; v<0x8000; ++v )
+                bad += p.pal.map_gray(v) != nearest(p.pal, ivec3(v));
+        printf("%-20s %8zu colors %6ld differ  %s\n", p.name, probe.size(), bad, bad ? "FAILED" : "ok");
+        failed += bad != 0;
+    }
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication app(argc, argv);
+    const char *json = nullptr;
+    for( int i=1; i<argc; ++i ) {
+        if (!strcmp(argv[i], "-o") && i+1 < argc) json = argv[++i];
+        else if (!strcmp(argv[i], "-t") && i+1 < argc) min_time = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--golden-record") && i+1 < argc) {
+            return golden(argv[i+1], true);
+        } else if (!strcmp(argv[i], "--golden-check") && i+1 < argc) {
+            return golden(argv[i+1], false);
+        } else if (!strcmp(argv[i], "--pool-check")) {
+            return pool_check();
+        } else if (!strcmp(argv[i], "--map-check")) {
+            return map_check();
+        }
+        else filter_str = argv[i];
+    }
+
+    struct { const char *name; QImage img; } inputs[] = {
+        {"uyryd", QImage(IMG_DIR "/uyryd.jpg")},
+        {"lumpsucker", QImage(IMG_DIR "/lumpsucker.png")},
+    };
+
+    std::vector<std::pair<std::string, QImage>> images;
+    for( auto &in : inputs ) {
+        if (in.img.isNull()) {
+            fprintf(stderr, "cannot load %s\n", in.name);
+            return 1;
+        }
+        QImage i = in.img.convertToFormat(QImage::Format_RGB32);
+        int up = i.width() < 1000 ? 8 : 2;
+        QImage big = i.scaled(i.width()*up, i.height()*up);
+        images.push_back({dims(i, in.name), i});
+        images.push_back({dims(big, in.name), big});
+    }
+
+    for( auto &im : images ) {
+        QImage const &i = im.second;
+        long long px = (long long) i.width() * i.height();
+        run("gscaled/down2", im.first, px, [&]() {
+            gscaled(i, i.width()/2, i.height()/2, Qt::IgnoreAspectRatio);
+        });
+        run("gscaled/up2", im.first, px, [&]() {
+            gscaled(i, i.width()*2, i.height()*2, Qt::IgnoreAspectRatio);
+        });
+        for( int bits : {5, 8} ) {
+            run("histogram/" + std::to_string(bits) + "bit", im.first, px, [&]() {
+                Histogram h(i, bits);
+            });
+        }
+    }
+
+    // a pseudo-random but fixed set of colors to match
+    std::vector<ivec3> probe(1 << 16);
+    {
+        std::mt19937 rng(1);
+        std::uniform_int_distribution<int> d(0, 0x7fff);
+        for( auto &c : probe ) c = ivec3(d(rng), d(rng), d(rng));
+    }
+    for( int n : {2, 16, 64, 256} ) {
+        Palette pal = random_palette(n, 1234);
+        volatile int sink = 0;
+        run("map_palette/" + std::to_string(n), "random", probe.size(), [&]() {
+            int acc = 0;
+            for( auto c : probe ) acc += pal.map(c);
+            sink = acc;
+        });
+        Palette ramp = gray_palette(n);
+        run("map_palette/" + std::to_string(n), "gray ramp", probe.size(), [&]() {
+            int acc = 0;
+            for( auto c : probe ) acc += ramp.map(c);
+            sink = acc;
+        });
+    }
+
+    // building palettes against opening them prebuilt
+    {
+        QString path = QDir::temp().filePath("manpal-bench.mpb");
+        PaletteBundle::write(path, {"ramp", "random"}, {gray_palette(256), random_palette(256, 1234)});
+        volatile int sink = 0;
+        run("palette_build/256", "ramp+random", 2, [&]() {
+            sink = gray_palette(256).n + random_palette(256, 1234).n;
+        });
+        run("palette_bundle/256", "ramp+random", 2, [&]() {
+            PaletteBundle b(path);
+            sink = b[0].n + b[1].n;
+        });
+        QFile::remove(path);
+    }
+
+    for( int n : {16, 256} ) {
+        QuantizerContext ctx;
+        ctx.pal = gray_palette(n);
+        for( auto &im : images ) {
+            QImage g = im.second.convertToFormat(QImage::Format_Grayscale8);
+            long long px = (long long) g.width() * g.height();
+            for( int mode=0; mode<qfun_names.size(); ++mode ) {
+                std::string name = "qfun/" + qfun_names[mode].toStdString() + "/gray" + std::to_string(n);
+                run(name, im.first, px, [&]() { quantizeImg(ctx, g, mode); });
+            }
+        }
+    }
+
+    for( int n : {16, 256} ) {
+        QuantizerContext ctx;
+        ctx.pal = random_palette(n, 1234);
+        for( auto &im : images ) {
+            QImage const &i = im.second;
+            long long px = (long long) i.width() * i.height();
+            for( int mode=0; mode<qfun_names.size(); ++mode ) {
+                std::string name = "qfun/" + qfun_names[mode].toStdString() + "/" + std::to_string(n);
+                run(name, im.first, px, [&]() { quantizeImg(ctx, i, mode); });
+            }
+            // all of the above at once, includes measuring their quality
+            ThreadPool pool;
+            run("quantizeAll/" + std::to_string(n), im.first, px, [&]() { quantizeAll(pool, ctx, i); });
+        }
+    }
+
+    QImage src = images[0].second;
+    for( int side : {32, 100, 200} ) {
+        auto data = points(src.scaled(side * 16 / 9, side));
+        auto data8 = points8(data);
+        std::vector<uint64_t> ones8(data.size(), 1);
+        for( int k : {4, 16, 64} ) {
+            std::string name = "kmeans_lloyd/k" + std::to_string(k);
+            run(name, std::to_string(data.size()) + "pts", data.size(), [&]() {
+                dkm::kmeans_lloyd(data, k);
+            });
+            run("kmeans_int/k" + std::to_string(k), std::to_string(data.size()) + "pts", data.size(), [&]() {
+                dkm::kmeans_lloyd(data8, ones8, k);
+            });
+        }
+        // every k up to 64 in one run
+        std::vector<float> ones(data.size(), 1);
+        run("kmeans_lbg/k1-64", std::to_string(data.size()) + "pts", data.size(), [&]() {
+            dkm::kmeans_lbg(data, ones, 64);
+        });
+    }
+
+    // palette from the full 8 bit histogram, directly and coarse to fine
+    for( auto &im : images ) {
+        Histogram h(im.second);
+        for( int k : {16, 64} ) {
+            run("kmeans_palette/8bit/k" + std::to_string(k), im.first, h.bins.size(), [&]() {
+                kmeans_palette(h, k);
+            });
+            run("kmeans_pyramid/k" + std::to_string(k), im.first, h.bins.size(), [&]() {
+                kmeans_pyramid(h, k);
+            });
+        }
+    }
+
+    if (json) write_json(json);
+    return 0;
+}
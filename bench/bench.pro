@@ -0,0 +1,38 @@
+#-------------------------------------------------
+#
+# Benchmarks for the quantizers, palette matching,
+# k-means and image scaling. No GUI.
+#
+#-------------------------------------------------
+
+QT       += core gui
+QT       -= widgets
+QMAKE_CXXFLAGS += -std=c++14 -O3 -g -Wno-parentheses -ffast-math -march=native -ftree-vectorize
+
+TARGET = manpal-bench
+TEMPLATE = app
+CONFIG(trace): DEFINES += MANPAL_TRACE
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+DEFINES += IMG_DIR=\\\"$$PWD/../img\\\"
+
+SOURCES += bench.cpp \
+    golden.cpp \
+    ../quality.cpp \
+    ../palette.cpp \
+    ../palbundle.cpp \
+    ../histogram.cpp \
+    ../quantize.cpp \
+    ../gifwriter.cpp \
+    ../trace.cpp
+
+HEADERS += ../palette.h \
+    ../palbundle.h \
+    ../histogram.h \
+    ../threadpool.h \
+    ../bufpool.h \
+    ../quantize.h \
+    ../quality.h \
+    ../dkm.hpp
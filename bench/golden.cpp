@@ -0,0 +1,260 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <QImage>
+#include <QFile>
+#include <QDir>
+#include "palette.h"
+#include "quantize.h"
+#include "quality.h"
+
+/*
+ * Golden image regression check
+ *
+ * Every quantizer runs over a fixed corpus with fixed palettes and dither
+ * settings. The index buffers are compared against ones recorded earlier.
+ * Modes listed in 'budgets' are allowed to differ, as long as their
+ * quality against the source stays within the stated loss from the golden
+ * output. Everything else must match exactly.
+ * One output per corpus entry is also written as GIF and compared byte for
+ * byte, which covers the encoder.
+ */
+
+struct Budget {
+    const char *mode;
+    double psnr_db, ssim, delta_e; // largest allowed loss
+};
+// SCQ sums its blurred error in floats, so the compiler and FPU decide
+// a few ties. a double precision build of it moved a few pixels of a
+// larger crop, losing less than 0.001 on every measure
+static const std::vector<Budget> budgets = {
+    {"Spatial (SCQ)", 0.05, 0.002, 0.05},
+};
+
+enum Look {
+    COLOR, // as loaded
+    GRAY, // r = g = b, for the gray quantizers
+    ALPHA, // with an alpha ramp, for the RGBA quantizers
+};
+
+// crops rather than scales the large image: Qt's smooth scaling differs
+// between versions and CPUs, a crop is the same everywhere
+struct Corpus {
+    const char *name, *image, *palette;
+    Look look;
+    int x, y, w, h; // crop, w 0 for the whole image
+};
+static const Corpus corpus[] = {
+    {"lumpsucker-hand16", "lumpsucker.png", "hand16", COLOR, 0, 0, 0, 0},
+    {"lumpsucker-gimp16", "lumpsucker.png", "gimp16", COLOR, 0, 0, 0, 0},
+    {"uyryd-random16", "uyryd.jpg", "random16", COLOR, 600, 330, 240, 160},
+    {"uyryd-gray8", "uyryd.jpg", "gray8", COLOR, 600, 330, 240, 160},
+    {"lumpsucker-random64", "lumpsucker.png", "random64", COLOR, 0, 0, 0, 0},
+    {"lumpsucker-gray-gray8", "lumpsucker.png", "gray8", GRAY, 0, 0, 0, 0},
+    {"lumpsucker-gimp16a", "lumpsucker.png", "gimp16a", COLOR, 0, 0, 0, 0},
+    {"lumpsucker-alpha-gimp16a", "lumpsucker.png", "gimp16a", ALPHA, 0, 0, 0, 0},
+    // 32 or more entries on a line take the line search, gray ones the gray table
+    {"lumpsucker-gray-gray32", "lumpsucker.png", "gray32", GRAY, 0, 0, 0, 0},
+    {"lumpsucker-duotone48", "lumpsucker.png", "duotone48", COLOR, 0, 0, 0, 0},
+};
+
+static const struct {
+    const char *name;
+    int err_fract, pingpong;
+} settings[] = {
+    {"e1024", 1024, 0},
+    {"e768pp", 768, 1},
+};
+
+// 0xAARRGGBB
+static Palette load_palette(const char *name)
+{
+    std::vector<uint32_t> c;
+    std::string s = name;
+    if (s == "hand16" || s == "gimp16" || s == "gimp16a") {
+        // the palettes of the hand and GIMP made samples
+        QImage p(QString(IMG_DIR "/lumpsucker-%1-16c.png").arg(s == "hand16" ? "hand" : "gimp"));
+        for( QRgb x : p.colorTable() )
+            c.push_back(x | 0xff000000);
+        if (s == "gimp16a") {
+            // a hole and a half transparent gray
+            c.push_back(0);
+            c.push_back(0x80808080);
+        }
+    } else if (s == "random16" || s == "random64") {
+        // a fixed LCG. <random> distributions differ between standard libraries
+        uint32_t x = 16;
+        for( int i=0, n=s == "random16" ? 16 : 64; i<n; ++i ) {
+            x = x * 1664525u + 1013904223u;
+            c.push_back(0xff000000 | x >> 8);
+        }
+    } else if (s == "gray8" || s == "gray32") {
+        for( int i=0, n=s == "gray8" ? 8 : 32; i<n; ++i )
+            c.push_back(qRgb(i*255/(n-1), i*255/(n-1), i*255/(n-1)));
+    } else if (s == "duotone48") {
+        // dark blue to pale yellow, even in linear light, so the entries lie
+        // on a line. the integer tables give the same colors everywhere
+        for( int i=0; i<48; ++i ) {
+            uint32_t x = 0xff000000;
+            for( int sh=16; sh>=0; sh-=8 ) {
+                int a = sRGBtoL((0x102050 >> sh & 0xff) * 0x7fff / 255), b = sRGBtoL((0xf0e0a0 >> sh & 0xff) * 0x7fff / 255);
+                x |= ( LtosRGB(a + (b - a) * i / 47) * 255 + 0x3fff ) / 0x7fff << sh;
+            }
+            c.push_back(x);
+        }
+    }
+    return Palette(c.data(), c.size(), true);
+}
+
+// the gray and alpha inputs are made here rather than by QImage conversions,
+// which may differ between Qt versions
+static QImage apply_look(QImage const &src, Look look)
+{
+    QImage img = src.convertToFormat(look == ALPHA ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    const int w = img.width();
+    for( int y=0; look != COLOR && y<img.height(); ++y ) {
+        QRgb *p = (QRgb*) img.scanLine(y);
+        for( int x=0; x<w; ++x ) {
+            if (look == GRAY) {
+                int v = qGray(p[x]);
+                p[x] = qRgb(v, v, v);
+            } else {
+                // clear on the left quarter, opaque on the right one
+                int a = std::min(255, std::max(0, (x - w/4) * 510 / w));
+                p[x] = qRgba(qRed(p[x]), qGreen(p[x]), qBlue(p[x]), a);
+            }
+        }
+    }
+    return img;
+}
+
+static QString slug(QString s)
+{
+    s = s.toLower();
+    for( int i=0; i<s.size(); ++i )
+        if (!s.at(i).isLetterOrNumber()) s[i] = '-';
+    return s;
+}
+
+static bool write_idx(QString const &path, QImage const &img)
+{
+    QFile f(path);
+    bool ok = f.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    int32_t hdr[3] = {0x5849504d, img.width(), img.height()}; // "MPIX"
+    ok = ok && f.write((const char*) hdr, sizeof hdr) == sizeof hdr;
+    for( int y=0; ok && y<img.height(); ++y )
+        ok = f.write((const char*) img.constScanLine(y), img.width()) == img.width();
+    ok = ok && f.flush();
+    if (!ok) fprintf(stderr, "%s: %s\n", qPrintable(path), qPrintable(f.errorString()));
+    return ok;
+}
+
+// the golden indices as an Indexed8 image with the current palette
+static QImage read_idx(QString const &path, QVector<QRgb> const &tab)
+{
+    QFile f(path);
+    int32_t hdr[3];
+    if (!f.open(QIODevice::ReadOnly)
+    || f.read((char*) hdr, sizeof hdr) != sizeof hdr || hdr[0] != 0x5849504d)
+        return QImage();
+    QImage img(hdr[1], hdr[2], QImage::Format_Indexed8);
+    img.setColorTable(tab);
+    for( int y=0; y<img.height(); ++y )
+        if (f.read((char*) img.scanLine(y), img.width()) != img.width())
+            return QImage();
+    return img;
+}
+
+static bool same_bytes(QString const &a, QString const &b)
+{
+    QFile fa(a), fb(b);
+    return fa.open(QIODevice::ReadOnly) && fb.open(QIODevice::ReadOnly) && fa.readAll() == fb.readAll();
+}
+
+static bool same_indices(QImage const &a, QImage const &b)
+{
+    if (a.size() != b.size()) return false;
+    for( int y=0; y<a.height(); ++y )
+        if (memcmp(a.constScanLine(y), b.constScanLine(y), a.width()))
+            return false;
+    return true;
+}
+
+int golden(QString const &dir, bool record)
+{
+    int failed = 0;
+    for( auto const &c : corpus ) {
+        QImage src(QString(IMG_DIR "/") + c.image);
+        QuantizerContext ctx;
+        ctx.pal = load_palette(c.palette);
+        if (src.isNull() || !ctx.pal.n) {
+            fprintf(stderr, "%s: cannot load input\n", c.name);
+            return 1;
+        }
+        if (c.w) src = src.copy(c.x, c.y, c.w, c.h);
+        src = apply_look(src, c.look);
+
+        for( auto const &st : settings ) {
+            ctx.err_fract = st.err_fract;
+            ctx.pingpong = st.pingpong;
+            for( int mode=0; mode<qfun_names.size(); ++mode ) {
+                QString path = QString("%1/%2-%3-%4.idx").arg(dir, c.name, slug(qfun_names[mode]), st.name);
+                QImage out = quantizeImg(ctx, src, mode);
+                Quality q = measure_quality(src, out);
+                const char *status;
+                bool ok = true;
+
+                if (record) {
+                    ok = write_idx(path, out);
+                    status = ok ? "RECORDED" : "WRITE FAILED";
+                } else {
+                    QImage gold = read_idx(path, out.colorTable());
+                    const Budget *b = nullptr;
+                    for( auto const &x : budgets )
+                        if (qfun_names[mode] == x.mode) b = &x;
+                    if (gold.isNull()) {
+                        status = "MISSING";
+                        ok = false;
+                    } else if (same_indices(gold, out)) {
+                        status = "OK";
+                    } else if (b) {
+                        Quality g = measure_quality(src, gold);
+                        ok = g.psnr - q.psnr <= b->psnr_db
+                            && g.ssim - q.ssim <= b->ssim
+                            && q.delta_e - g.delta_e <= b->delta_e;
+                        status = ok ? "OK (in budget)" : "OVER BUDGET";
+                    } else {
+                        status = "MISMATCH";
+                        ok = false;
+                    }
+                }
+                if (!ok) ++failed;
+                printf("%-24s %-22s %-8s psnr %6.2f ssim %.4f dE %6.3f  %s\n",
+                    c.name, qfun_names[mode].toLatin1().constData(), st.name,
+                    q.psnr, q.ssim, q.delta_e, status);
+            }
+        }
+
+        // Floyd-Steinberg with the first settings, as GIF
+        ctx.err_fract = settings[0].err_fract;
+        ctx.pingpong = settings[0].pingpong;
+        QImage out = quantizeImg(ctx, src, 1);
+        QString path = QString("%1/%2.gif").arg(dir, c.name);
+        QString tmp = QDir::tempPath() + "/manpal-golden.gif";
+        bool ok;
+        if (record) {
+            ok = saveIndexed(out, path);
+        } else {
+            ok = saveIndexed(out, tmp) && same_bytes(path, tmp);
+            QFile::remove(tmp);
+        }
+        if (!ok) ++failed;
+        printf("%-24s %-22s %-8s %s\n", c.name, "GIF", settings[0].name,
+            ok ? ( record ? "RECORDED" : "OK" ) : ( record ? "WRITE FAILED" : "MISMATCH" ));
+    }
+    if (failed) printf("%d golden checks failed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+#include <new>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Recycles scratch buffers between frames. get() hands out a buffer of at
+ * least n bytes, put() takes it back. Once the sizes settle every request
+ * is served from buffers allocated earlier. Thread safe.
+ * Buffers are 16 byte aligned and remember which pool they came from.
+ *
+ * A buffer is only reused for requests of at least half its size. When a
+ * request has to allocate and more than a third of what the pool holds
+ * would sit idle, the idle buffers that could not serve it are freed, least
+ * recently used first. So while a view is resized the pool follows its
+ * size instead of keeping a set of buffers for every size it went through,
+ * and jobs of different sizes that take turns keep their buffers.
+ * Full resolution jobs still get a pool of their own in the window, so
+ * their buffers don't count against the preview's.
+ */
+class BufferPool {
+    struct Slot {
+        uint8_t *p;
+        size_t size;
+        bool used;
+        size_t last; // when it was handed out last
+    };
+    std::vector<Slot> slots;
+    std::mutex m;
+    size_t gets = 0, news = 0;
+
+    static const size_t HEAD = 16; // room for the owner, keeps alignment
+
+public:
+    BufferPool() { slots.reserve(64); }
+    BufferPool(BufferPool const&) = delete;
+
+    ~BufferPool()
+    {
+        for( auto &s : slots )
+            ::operator delete(s.p);
+    }
+
+    void *get(size_t n)
+    {
+        std::lock_guard<std::mutex> l(m);
+        auto fits = [n](Slot const &s) { return s.size >= n && s.size / 2 <= n; };
+        Slot *best = nullptr;
+        for( auto &s : slots )
+            if (!s.used && fits(s) && ( !best || s.size < best->size ))
+                best = &s;
+        if (!best) {
+            // the sizes moved on, drop what is left over from before
+            size_t held = n, used = n;
+            for( auto const &s : slots ) {
+                held += s.size;
+                if (s.used) used += s.size;
+            }
+            while (2 * held > 3 * used) {
+                Slot *old = nullptr;
+                for( auto &s : slots )
+                    if (!s.used && !fits(s) && ( !old || s.last < old->last ))
+                        old = &s;
+                if (!old) break;
+                held -= old->size;
+                ::operator delete(old->p);
+                *old = slots.back();
+                slots.pop_back();
+            }
+            uint8_t *p = (uint8_t*) ::operator new(n + HEAD);
+            ++news;
+            *(BufferPool**) p = this;
+            slots.push_back({p, n, false, 0});
+            best = &slots.back();
+        }
+        best->used = true;
+        best->last = ++gets;
+        return best->p + HEAD;
+    }
+
+    void put(void *b)
+    {
+        if (!b) return;
+        std::lock_guard<std::mutex> l(m);
+        for( auto &s : slots )
+            if (s.p + HEAD == b) s.used = false;
+    }
+
+    // bytes held, in use or idle
+    size_t allocated()
+    {
+        std::lock_guard<std::mutex> l(m);
+        size_t t = 0;
+        for( auto const &s : slots ) t += s.size;
+        return t;
+    }
+
+    // buffers allocated so far
+    size_t allocations()
+    {
+        std::lock_guard<std::mutex> l(m);
+        return news;
+    }
+
+    // returns b to whichever pool handed it out
+    static void release(void *b)
+    {
+        if (b) ( *(BufferPool**) ( (uint8_t*) b - HEAD ) )->put(b);
+    }
+};
+
+/*
+ * Typed buffer from a pool, or from the heap when there is no pool
+ */
+template<typename T>
+class PoolArray {
+    BufferPool *pool;
+    T *p;
+public:
+    PoolArray(BufferPool *bp, size_t n) : pool(bp)
+    {
+        p = pool ? (T*) pool->get(n * sizeof(T)) : new T[n];
+    }
+    ~PoolArray()
+    {
+        if (pool) pool->put(p);
+        else delete[] p;
+    }
+    PoolArray(PoolArray const&) = delete;
+    T *data() { return p; }
+    T &operator[](size_t i) { return p[i]; }
+};
+
+#endif // BUFPOOL_H
@@ -0,0 +1,272 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QImage>
+#include "quantize.h"
+#include "histogram.h"
+#include "tuner.h"
+#include "palbundle.h"
+#include "palorder.h"
+
+/*
+ * manpal -q INPUT OUTPUT [-n colors|-r rms] [-p palette_image] [-P bundle [-e name]] [-m method|all] [-z]
+ * manpal -t INPUT
+ * manpal -b BUNDLE palette_image...
+ * manpal -d SOCKET -P BUNDLE
+ * manpal -c SOCKET REQUEST
+ *
+ * Quantizes without opening a window. The palette is read from an image,
+ * every distinct color in reading order like the PNG strips manpal writes,
+ * taken from a palette bundle, or made with k-means from the histogram of
+ * the input. -r picks the fewest colors that keep the RMS error of the
+ * palette, in 8 bit RGB units, within the limit.
+ * With '-m all' every method is run in one pass and written next to OUTPUT
+ * as OUTPUT-0.png, OUTPUT-1.png, ..., and their figures are printed.
+ * Methods that can (the spatial one) adjust a palette made with k-means to
+ * the dither as well.
+ * -z orders the color table of the output for a smaller file, see palorder.h.
+ * -t prints the settings the tuner finds best for INPUT.
+ * -b builds a bundle from palette images, named after the files.
+ * -d runs as a service with the palettes of a bundle, see daemon.cpp.
+ * -c sends one request to it and prints the reply.
+ */
+
+static int usage()
+{
+    fprintf(stderr, "usage: manpal -q INPUT OUTPUT [-n colors|-r rms] [-p palette_image] [-P bundle [-e name]] [-m method|all] [-z]\n"
+        "       manpal -t INPUT\n"
+        "       manpal -b BUNDLE palette_image...\n"
+        "       manpal -d SOCKET -P BUNDLE\n"
+        "       manpal -c SOCKET REQUEST\n");
+    for( int i=0; i<qfun_names.size(); ++i )
+        fprintf(stderr, "  method %d: %s\n", i, qPrintable(qfun_names[i]));
+    return 2;
+}
+
+// distinct colors of an image in reading order, up to 256
+static std::vector<uint32_t> palette_image(QImage const &img)
+{
+    std::vector<uint32_t> pal;
+    for( int y=0; y<img.height(); ++y )
+        for( int x=0; x<img.width() && pal.size() < 256; ++x ) {
+            uint32_t c = img.pixel(x, y);
+            if (std::find(pal.begin(), pal.end(), c) == pal.end()) pal.push_back(c);
+        }
+    return pal;
+}
+
+// no pixel of an indexed image uses an entry with alpha below 255
+static bool opaque(QImage const &img)
+{
+    auto tab = img.colorTable();
+    bool clear[256] = {};
+    bool any = false;
+    for( int i=0; i<tab.size() && i<256; ++i )
+        any |= clear[i] = qAlpha(tab[i]) != 255;
+    for( int y=0; any && y<img.height(); ++y ) {
+        uchar const *s = img.constScanLine(y);
+        for( int x=0; x<img.width(); ++x )
+            if (clear[s[x]]) return false;
+    }
+    return true;
+}
+
+// out.png -> out-3.png
+static QString variant_path(QString const &path, int i)
+{
+    QFileInfo f(path);
+    QString suffix = f.suffix().isEmpty() ? QString("png") : f.suffix();
+    return f.path() + "/" + f.completeBaseName() + "-" + QString::number(i) + "." + suffix;
+}
+
+static int tune(QImage const &src)
+{
+    ThreadPool pool;
+    auto res = tune_dither(pool, src);
+    printf("%6s %-28s %6s %3s %8s %10s\n", "colors", "method", "fract", "pp", "dE", "GIF bytes");
+    for( auto const &r : res )
+        printf("%6d %-28s %6d %3d %8.3f %10ld\n", (int) r.pal.size(), qPrintable(qfun_names[r.mode]),
+            r.err_fract, r.pingpong, r.delta_e, r.bytes);
+    return 0;
+}
+
+#ifdef Q_OS_UNIX
+int serve(const char *path, PaletteBundle const &bundle); // daemon.cpp
+int request(const char *path, std::string const &line);
+#endif
+
+static int make_bundle(const char *path, std::vector<const char*> const &images)
+{
+    std::vector<QString> names;
+    std::vector<Palette> pals;
+    for( const char *i : images ) {
+        QImage p(QString::fromLocal8Bit(i));
+        if (p.isNull()) {
+            fprintf(stderr, "cannot read %s\n", i);
+            return 1;
+        }
+        auto c = palette_image(p);
+        names.push_back(QFileInfo(QString::fromLocal8Bit(i)).completeBaseName());
+        pals.push_back(Palette(c.data(), c.size(), true));
+    }
+    if (!PaletteBundle::write(QString::fromLocal8Bit(path), names, pals)) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int cli_main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const char *in = nullptr, *out = nullptr, *pal_path = nullptr, *tune_path = nullptr;
+    const char *bundle_path = nullptr, *entry = nullptr, *bundle_out = nullptr;
+    const char *serve_path = nullptr;
+    std::vector<const char*> bundle_in;
+    int colors = 16, mode = 1;
+    double max_rms = 0;
+    bool all = false, compact = false;
+    for( int i=1; i<argc; ++i ) {
+        if (!strcmp(argv[i], "-q") && i+2 < argc) {
+            in = argv[++i];
+            out = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-t") && i+1 < argc) tune_path = argv[++i];
+        else if (!strcmp(argv[i], "-n") && i+1 < argc) colors = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i+1 < argc) max_rms = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-p") && i+1 < argc) pal_path = argv[++i];
+        else if (!strcmp(argv[i], "-z")) compact = true;
+        else if (!strcmp(argv[i], "-P") && i+1 < argc) bundle_path = argv[++i];
+        else if (!strcmp(argv[i], "-e") && i+1 < argc) entry = argv[++i];
+        else if (!strcmp(argv[i], "-b") && i+1 < argc) bundle_out = argv[++i];
+#ifdef Q_OS_UNIX
+        else if (!strcmp(argv[i], "-d") && i+1 < argc) serve_path = argv[++i];
+        else if (!strcmp(argv[i], "-c") && i+2 < argc) {
+            std::string line;
+            for( int j=i+2; j<argc; ++j )
+                line += std::string(j > i+2 ? " " : "") + argv[j];
+            return request(argv[i+1], line);
+        }
+#endif
+        else if (!strcmp(argv[i], "-m") && i+1 < argc) {
+            // "all" or a method number, nothing else
+            char *end;
+            long m = strtol(argv[++i], &end, 10);
+            all = !strcmp(argv[i], "all");
+            if (!all && ( end == argv[i] || *end || m < 0 || m >= qfun_names.size() ))
+                return usage();
+            mode = all ? mode : m;
+        }
+        else if (bundle_out && argv[i][0] != '-') bundle_in.push_back(argv[i]);
+        else return usage();
+    }
+    if (bundle_out)
+        return bundle_in.empty() ? usage() : make_bundle(bundle_out, bundle_in);
+#ifdef Q_OS_UNIX
+    if (serve_path) {
+        PaletteBundle b;
+        if (!bundle_path || !b.open(QString::fromLocal8Bit(bundle_path))) {
+            fprintf(stderr, "-d needs a palette bundle, -P\n");
+            return 1;
+        }
+        return serve(serve_path, b);
+    }
+#endif
+    if (tune_path) {
+        QImage src(QString::fromLocal8Bit(tune_path));
+        if (src.isNull()) {
+            fprintf(stderr, "cannot read %s\n", tune_path);
+            return 1;
+        }
+        return tune(src);
+    }
+    if (!in || colors < 1 || colors > 256 || mode < 0 || mode >= qfun_names.size())
+        return usage();
+
+    QImage src(QString::fromLocal8Bit(in));
+    if (src.isNull()) {
+        fprintf(stderr, "cannot read %s\n", in);
+        return 1;
+    }
+
+    QuantizerContext ctx;
+    if (bundle_path) {
+        // prebuilt, copied as is
+        PaletteBundle b(QString::fromLocal8Bit(bundle_path));
+        int i = entry ? b.find(QString::fromUtf8(entry)) : 0;
+        if (!b.isOpen() || i < 0 || i >= b.size()) {
+            fprintf(stderr, "no palette %s in %s\n", entry ? entry : "", bundle_path);
+            return 1;
+        }
+        ctx.pal = b[i];
+    } else {
+        std::vector<uint32_t> pal;
+        if (pal_path) {
+            QImage p(QString::fromLocal8Bit(pal_path));
+            if (p.isNull()) {
+                fprintf(stderr, "cannot read %s\n", pal_path);
+                return 1;
+            }
+            pal = palette_image(p);
+        } else if (max_rms > 0) {
+            // sized at 5 bits, refined on all 8
+            ThreadPool pool;
+            Histogram h(src, 8, QImage(), &pool);
+            PaletteLadder ladder(h.reduced(5));
+            int k = ladder.smallest_k(max_rms);
+            if (k > 0) fprintf(stderr, "%d colors, rms %.2f\n", k, ladder.rms[k-1]);
+            pal = refine_palette(h, ladder.get(k), 5);
+        } else {
+            ThreadPool pool;
+            pal = kmeans_pyramid(Histogram(src, 8, QImage(), &pool), colors);
+        }
+        // palette images are 0xAARRGGBB, the k-means palettes 0xRRGGBB and opaque
+        ctx.pal = Palette(pal.data(), pal.size(), pal_path != nullptr);
+    }
+    if (!ctx.pal.n) {
+        fprintf(stderr, "empty palette\n");
+        return 1;
+    }
+    QString out_path = QString::fromLocal8Bit(out);
+
+    // an opaque input never comes out with holes
+    const bool keep_opaque = !src.hasAlphaChannel();
+    auto save = [compact, keep_opaque](QImage img, QString const &path) {
+        if (keep_opaque && !opaque(img)) {
+            fprintf(stderr, "%s: transparent pixels in the output of an opaque image\n", qPrintable(path));
+            return false;
+        }
+        if (compact) apply_order(img, compact_order(img));
+        return saveIndexed(img, path);
+    };
+
+    if (!all) {
+        // a palette made here may be moved, one that was given stays as it is
+        bool fit = ( qfun_uses[mode] & FITS_PALETTE ) && !pal_path && !bundle_path;
+        if (!save(fit ? quantizeSpatial(ctx, src) : quantizeImg(ctx, src, mode), out_path)) {
+            fprintf(stderr, "cannot write %s\n", out);
+            return 1;
+        }
+        return 0;
+    }
+
+    ThreadPool pool;
+    auto res = quantizeAll(pool, ctx, src);
+    printf("%-28s %10s %8s %7s %7s  %s\n", "method", "ms", "PSNR", "SSIM", "dE", "file");
+    int ret = 0;
+    for( size_t i=0; i<res.size(); ++i ) {
+        QString path = variant_path(out_path, i);
+        if (!save(res[i].img, path)) {
+            fprintf(stderr, "cannot write %s\n", qPrintable(path));
+            ret = 1;
+        }
+        auto const &q = res[i].quality;
+        printf("%-28s %10.2f %8.2f %7.4f %7.3f  %s\n", qPrintable(qfun_names[i]),
+            res[i].ms, q.psnr, q.ssim, q.delta_e, qPrintable(path));
+    }
+    return ret;
+}
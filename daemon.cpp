@@ -0,0 +1,339 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <chrono>
+#include <condition_variable>
+#include <system_error>
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <QImage>
+#include <QString>
+#include "quantize.h"
+#include "palbundle.h"
+
+/*
+ * Quantization service on a Unix domain socket.
+ * Palettes come from a bundle and stay resident, together with everything
+ * Palette builds for them. Requests that arrive close together are run as
+ * one quantizeBatch on the worker pool.
+ *
+ * One request per line, one reply per request, "ok ..." or "error ...".
+ * Paths and names may not contain spaces.
+ *
+ * palettes                          ok NAME...
+ * file PALETTE METHOD IN OUT        ok MILLISECONDS
+ *     reads IN, writes OUT like saveIndexed
+ * shm PALETTE METHOD NAME W H [alpha]   ok MILLISECONDS
+ *     NAME is a POSIX shared memory object of at least W*H*5 bytes:
+ *     W*H pixels 0xAARRGGBB, alpha ignored unless 'alpha' is given,
+ *     followed by W*H palette indices, written by the service
+ * quit                              ok, then the service stops
+ */
+
+namespace {
+
+struct Request {
+    QuantizeJob job;
+    std::promise<QImage> done;
+};
+
+class Batcher {
+    ThreadPool &pool;
+    const size_t max_batch;
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<Request*> q;
+    bool stopping = false;
+    std::thread th;
+
+    void loop()
+    {
+        for(;;) {
+            std::vector<Request*> batch;
+            {
+                std::unique_lock<std::mutex> l(m);
+                cv.wait(l, [this]{ return stopping || !q.empty(); });
+                if (q.empty()) return;
+                // let requests that are on their way join this batch
+                cv.wait_for(l, std::chrono::milliseconds(2), [this]{ return stopping || q.size() >= max_batch; });
+                while (!q.empty() && batch.size() < max_batch) {
+                    batch.push_back(q.front());
+                    q.pop_front();
+                }
+            }
+            std::vector<QuantizeJob> jobs;
+            for( auto r : batch ) jobs.push_back(r->job);
+            auto out = quantizeBatch(pool, jobs);
+            for( size_t i=0; i<batch.size(); ++i )
+                batch[i]->done.set_value(out[i]);
+        }
+    }
+
+public:
+    explicit Batcher(ThreadPool &p) : pool(p), max_batch(2 * p.size()), th(&Batcher::loop, this) {}
+
+    ~Batcher()
+    {
+        {
+            std::lock_guard<std::mutex> l(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        th.join();
+    }
+
+    // blocks until the batch with r in it is done
+    QImage run(Request &r)
+    {
+        auto f = r.done.get_future();
+        {
+            std::lock_guard<std::mutex> l(m);
+            q.push_back(&r);
+        }
+        cv.notify_one();
+        return f.get();
+    }
+};
+
+struct Service {
+    PaletteBundle const &bundle;
+    std::vector<QuantizerContext> ctx; // one per bundle entry
+    ThreadPool pool;
+    Batcher batcher{pool};
+    std::atomic<bool> quit{false};
+    int listen_fd = -1;
+    std::mutex m;
+    std::condition_variable gone; // a client left
+    std::vector<int> clients;
+
+    explicit Service(PaletteBundle const &b) : bundle(b), ctx(b.size())
+    {
+        for( int i=0; i<b.size(); ++i )
+            ctx[i].pal = b[i]; // copied once, then shared by every request
+    }
+
+    std::string handle(std::string const &line);
+    std::string quantize(int pal, int mode, QImage const &src, QImage &out);
+    std::string shm(int pal, int mode, std::string const &name, int w, int h, bool alpha);
+    void client(int fd);
+    void stop();
+    void wait_clients();
+};
+
+// all of s, across short writes
+static bool write_all(int fd, std::string const &s)
+{
+    size_t done = 0;
+    while (done < s.size()) {
+        ssize_t n = write(fd, s.data() + done, s.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+static std::string ms_since(std::chrono::steady_clock::time_point t0)
+{
+    char buf[32];
+    snprintf(buf, sizeof buf, "ok %.2f", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    return buf;
+}
+
+std::string Service::quantize(int pal, int mode, QImage const &src, QImage &out)
+{
+    if (pal < 0) return "error unknown palette";
+    if (mode < 0 || mode >= qfun_names.size()) return "error unknown method";
+    if (src.isNull()) return "error cannot read image";
+    Request r;
+    r.job = {&ctx[pal], src, mode};
+    out = batcher.run(r);
+    return "";
+}
+
+std::string Service::shm(int pal, int mode, std::string const &name, int w, int h, bool alpha)
+{
+    if (w <= 0 || h <= 0) return "error bad size";
+    size_t n = (size_t) w * h;
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) return "error cannot open " + name;
+    struct stat st;
+    if (fstat(fd, &st) || (size_t) st.st_size < n * 5) {
+        close(fd);
+        return "error " + name + " is too small";
+    }
+    void *p = mmap(nullptr, n * 5, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return "error cannot map " + name;
+    // wraps the pixels, no copy
+    QImage src((uchar const*) p, w, h, w * 4, alpha ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    QImage out;
+    std::string err = quantize(pal, mode, src, out);
+    if (err.empty()) {
+        uint8_t *d = (uint8_t*) p + n * 4;
+        for( int y=0; y<h; ++y )
+            memcpy(d + (size_t) y * w, out.constScanLine(y), w);
+    }
+    munmap(p, n * 5);
+    return err;
+}
+
+std::string Service::handle(std::string const &line)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    std::istringstream in(line);
+    std::string cmd, pal;
+    in >> cmd;
+    if (cmd == "palettes") {
+        std::string r = "ok";
+        for( int i=0; i<bundle.size(); ++i )
+            r += std::string(" ") + bundle.name(i);
+        return r;
+    }
+    if (cmd == "quit") {
+        stop();
+        return "ok";
+    }
+    int mode = -1;
+    in >> pal >> mode;
+    int pi = bundle.find(QString::fromStdString(pal));
+    if (cmd == "file") {
+        std::string src, dst;
+        in >> src >> dst;
+        QImage out;
+        std::string err = quantize(pi, mode, QImage(QString::fromStdString(src)), out);
+        if (!err.empty()) return err;
+        if (!saveIndexed(out, QString::fromStdString(dst))) return "error cannot write " + dst;
+        return ms_since(t0);
+    }
+    if (cmd == "shm") {
+        std::string name, flag;
+        int w = 0, h = 0;
+        in >> name >> w >> h >> flag;
+        std::string err = shm(pi, mode, name, w, h, flag == "alpha");
+        return err.empty() ? ms_since(t0) : err;
+    }
+    return "error unknown request";
+}
+
+void Service::client(int fd)
+{
+    std::string buf;
+    char tmp[4096];
+    ssize_t got;
+    bool alive = true; // until the client stops reading
+    while (alive && (got = read(fd, tmp, sizeof tmp)) > 0) {
+        buf.append(tmp, got);
+        size_t nl;
+        while (alive && (nl = buf.find('\n')) != std::string::npos) {
+            std::string reply = handle(buf.substr(0, nl)) + "\n";
+            buf.erase(0, nl + 1);
+            alive = write_all(fd, reply);
+        }
+    }
+    std::lock_guard<std::mutex> l(m);
+    clients.erase(std::find(clients.begin(), clients.end(), fd));
+    close(fd);
+    gone.notify_all();
+}
+
+void Service::stop()
+{
+    quit = true;
+    std::lock_guard<std::mutex> l(m);
+    shutdown(listen_fd, SHUT_RDWR); // wakes up accept
+    for( int fd : clients )
+        shutdown(fd, SHUT_RD); // lets clients finish what they are writing
+}
+
+void Service::wait_clients()
+{
+    std::unique_lock<std::mutex> l(m);
+    gone.wait(l, [this]{ return clients.empty(); });
+}
+
+} // namespace
+
+int serve(const char *path, PaletteBundle const &bundle)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "socket path too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // a client that hangs up before its reply is an error on its write, not the end of the service
+    signal(SIGPIPE, SIG_IGN);
+
+    Service s(bundle);
+    s.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (s.listen_fd < 0 || bind(s.listen_fd, (sockaddr*) &addr, sizeof addr) || listen(s.listen_fd, 16)) {
+        perror(path);
+        return 1;
+    }
+    fprintf(stderr, "listening on %s, %d palettes, %d workers\n", path, bundle.size(), s.pool.size());
+
+    // client threads are detached and counted in s.clients, so a long
+    // running service doesn't keep one finished thread per connection
+    while (!s.quit) {
+        int fd = accept(s.listen_fd, nullptr, nullptr);
+        if (fd < 0) break;
+        std::lock_guard<std::mutex> l(s.m);
+        try {
+            std::thread(&Service::client, &s, fd).detach();
+            s.clients.push_back(fd);
+        } catch (std::system_error const &) {
+            close(fd); // out of threads, the client sees the connection close
+        }
+    }
+    s.stop();
+    s.wait_clients();
+    close(s.listen_fd);
+    unlink(path);
+    return 0;
+}
+
+// sends one request, prints the reply. 0 if it was ok
+int request(const char *path, std::string const &line)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr*) &addr, sizeof addr)) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    std::string msg = line + "\n", reply;
+    if (!write_all(fd, msg)) {
+        perror(path);
+        close(fd);
+        return 1;
+    }
+    char c;
+    while (read(fd, &c, 1) == 1 && c != '\n')
+        reply += c;
+    close(fd);
+    printf("%s\n", reply.c_str());
+    return reply.compare(0, 2, "ok") ? 1 : 0;
+}
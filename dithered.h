@@ -1,8 +1,7 @@
 #ifndef DITHERED_H
 #define DITHERED_H
-
-int ed_err_fract = 1024; // 10 bits of fraction. used to limit error diffusion to reduce color bleeding
-int ed_pingpong_enable = 0; // alternative left-right and right-left iteration
+#include <algorithm>
+#include "bufpool.h"
 
 /*
  * Error diffusion dithering class
@@ -17,11 +16,15 @@ template<
 struct DitherED {
 
     COLOR *buf[4];
+    COLOR *mem; // all 4 rows
+    BufferPool *pool;
     int img_w;
     int cur_x_=0;
     int pingpong=0;
     int pingpong_counter=0;
     int cur_x_inc=1;
+    int err_fract; // 10 bits of fraction. used to limit error diffusion to reduce color bleeding
+    int pingpong_enable; // alternative left-right and right-left iteration
 
     void forward()
     {
@@ -37,22 +40,29 @@ struct DitherED {
         cur_x_ = img_w - 1;
     }
 
-    DitherED(int w)
+    // rows come from the pool when there is one, so nothing is allocated per image
+    DitherED(int w, int fract=1024, int pp=0, BufferPool *bp=nullptr)
     {
         img_w = w;
-        int bufsize = w * sizeof(COLOR);
+        err_fract = fract;
+        pingpong_enable = pp;
+        pool = bp;
+        size_t n = 4 * ( w + 32 );
+        mem = pool ? (COLOR*) pool->get(n * sizeof(COLOR)) : new COLOR[n];
         for( int i=0; i<4; ++i ) {
-            buf[i] = new COLOR[w + 32] + 16;
-            memset(buf[i], 0, bufsize);
+            buf[i] = mem + i * ( w + 32 ) + 16;
+            std::fill(buf[i], buf[i] + w, COLOR(0));
         }
     }
 
     ~DitherED()
     {
-        for( int i=0; i<4; ++i )
-            delete ( buf[i] - 16 );
+        if (pool) pool->put(mem);
+        else delete[] mem;
     }
 
+    DitherED(DitherED const&) = delete;
+
     void endln() {
         auto b0 = buf[0];
         buf[0] = buf[1];
@@ -69,7 +79,7 @@ struct DitherED {
         COLOR c1 = quantized(c0 - cur_e);
         COLOR e = c1 - c0;
 
-        e = e * ed_err_fract >> 10; // reduce distributed error by some fraction
+        e = e * err_fract >> 10; // reduce distributed error by some fraction
         buf[3][cur_x] = 0; // wipe the next bottom line
         for( int dx=1; dx<cols-off_x; dx++)
             buf[0][cur_x1 + (dx^neg)] += e * R0[dx-1];
@@ -89,7 +99,7 @@ struct DitherED {
         if ( (unsigned) cur_x_ >= (unsigned) img_w ) {
             cur_x_ = 0;
             endln();
-            if (ed_pingpong_enable && ++pingpong_counter == 15) {
+            if (pingpong_enable && ++pingpong_counter == 15) {
                 pingpong_counter = 0;
                 if (pingpong) forward(); else reverse();
             }
@@ -126,4 +136,16 @@ static constexpr int FS0[] =       {7};
 static constexpr int FS1[] = {3, 5, 1};
 typedef DitherED<FS0,FS1,nullptr, 3, 1, 4, ivec3> DitherFS;
 
+// single channel versions, for gray images with gray palettes
+typedef DitherED<JJN0,JJN1,JJN2, 5, 3, 13, int> DitherJJNGray;
+typedef DitherED<S2R0,S2R1,nullptr, 5, 3, 4, int> DitherS2Gray;
+typedef DitherED<S3R0,S3R1,nullptr, 5, 3, 5, int> DitherS3Gray;
+typedef DitherED<FS0,FS1,nullptr, 3, 1, 4, int> DitherFSGray;
+
+// four channel versions, for premultiplied RGBA
+typedef DitherED<JJN0,JJN1,JJN2, 5, 3, 13, ivec4> DitherJJNRGBA;
+typedef DitherED<S2R0,S2R1,nullptr, 5, 3, 4, ivec4> DitherS2RGBA;
+typedef DitherED<S3R0,S3R1,nullptr, 5, 3, 5, ivec4> DitherS3RGBA;
+typedef DitherED<FS0,FS1,nullptr, 3, 1, 4, ivec4> DitherFSRGBA;
+
 #endif // DITHERED_H
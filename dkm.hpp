@@ -14,6 +14,10 @@
 #include <type_traits>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /*
 DKM - A k-means implementation that is generic across variable data dimensions.
 */
@@ -156,6 +160,36 @@ std::vector<std::array<T, N>> calculate_means(const std::vector<std::array<T, N>
 	return means;
 }
 
+/*
+Weighted version of the above. Each data point counts as 'weight' identical points.
+*/
+template <typename T, size_t N>
+std::vector<std::array<T, N>> calculate_means(const std::vector<std::array<T, N>>& data,
+	const std::vector<T>& weights,
+	const std::vector<uint32_t>& clusters,
+	const std::vector<std::array<T, N>>& old_means,
+	uint32_t k) {
+	std::vector<std::array<T, N>> means(k);
+	std::vector<T> count(k, T());
+	for (size_t i = 0; i < std::min(clusters.size(), data.size()); ++i) {
+		auto& mean = means[clusters[i]];
+		count[clusters[i]] += weights[i];
+		for (size_t j = 0; j < std::min(data[i].size(), mean.size()); ++j) {
+			mean[j] += data[i][j] * weights[i];
+		}
+	}
+	for (size_t i = 0; i < k; ++i) {
+		if (count[i] == 0) {
+			means[i] = old_means[i];
+		} else {
+			for (size_t j = 0; j < means[i].size(); ++j) {
+				means[i][j] /= count[i];
+			}
+		}
+	}
+	return means;
+}
+
 } // namespace details
 
 
@@ -199,6 +233,346 @@ std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd(
 	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
 }
 
+/*
+Weighted k-means warm started from the given means instead of kmeans++. The means where locked[i] is
+true never move, points still get assigned to them, so the others fit around the fixed ones.
+k is init.size(). Stops at convergence or after max_iter iterations.
+*/
+template <typename T, size_t N>
+std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>> kmeans_lloyd(
+	const std::vector<std::array<T, N>>& data, const std::vector<T>& weights,
+	const std::vector<std::array<T, N>>& init, const std::vector<bool>& locked, int max_iter = 100) {
+	static_assert(std::is_arithmetic<T>::value && std::is_signed<T>::value,
+		"kmeans_lloyd requires the template parameter T to be a signed arithmetic type (e.g. float, double, int)");
+	assert(!init.empty());
+	assert(locked.size() == init.size());
+	assert(weights.size() == data.size());
+	const uint32_t k = init.size();
+	std::vector<std::array<T, N>> means = init;
+	std::vector<uint32_t> clusters;
+	for (int it = 0; it < max_iter; ++it) {
+		clusters = details::calculate_clusters(data, means);
+		auto old_means = means;
+		means = details::calculate_means(data, weights, clusters, old_means, k);
+		for (uint32_t i = 0; i < k; ++i) {
+			if (locked[i]) means[i] = init[i];
+		}
+		if (means == old_means) break;
+	}
+	clusters = details::calculate_clusters(data, means);
+	return std::tuple<std::vector<std::array<T, N>>, std::vector<uint32_t>>(means, clusters);
+}
+
+namespace details {
+
+/*
+Nearest mean of every point, for the 8 bit integer k-means below. Distances are exact in int32.
+With SSE2 four means are compared at once: r,g pairs and b,0 pairs are int16 and _mm_madd_epi16
+sums their squares. Ties go to the lowest index either way, so both paths give the same clusters.
+*/
+inline void closest_means_u8(const std::vector<std::array<uint8_t, 3>>& data,
+	const std::vector<std::array<int16_t, 3>>& means, std::vector<uint32_t>& clusters) {
+	const uint32_t k = means.size();
+	clusters.resize(data.size());
+#if defined(__SSE2__)
+	const uint32_t k4 = (k + 3) & ~3u;
+	std::vector<int16_t> rg(2 * k4, 0x2000), b0(2 * k4, 0); // padding is far from every point
+	for (uint32_t j = 0; j < k; ++j) {
+		rg[2 * j] = means[j][0];
+		rg[2 * j + 1] = means[j][1];
+		b0[2 * j] = means[j][2];
+	}
+	for (size_t i = 0; i < data.size(); ++i) {
+		const auto& p = data[i];
+		__m128i pa = _mm_set1_epi32(p[0] | p[1] << 16), pb = _mm_set1_epi32(p[2]);
+		__m128i best = _mm_set1_epi32(INT32_MAX), best_j = _mm_setzero_si128();
+		__m128i j4 = _mm_setr_epi32(0, 1, 2, 3);
+		for (uint32_t j = 0; j < k4; j += 4) {
+			__m128i da = _mm_sub_epi16(_mm_loadu_si128((const __m128i*) &rg[2 * j]), pa);
+			__m128i db = _mm_sub_epi16(_mm_loadu_si128((const __m128i*) &b0[2 * j]), pb);
+			__m128i d = _mm_add_epi32(_mm_madd_epi16(da, da), _mm_madd_epi16(db, db));
+			__m128i lt = _mm_cmplt_epi32(d, best);
+			best = _mm_or_si128(_mm_and_si128(lt, d), _mm_andnot_si128(lt, best));
+			best_j = _mm_or_si128(_mm_and_si128(lt, j4), _mm_andnot_si128(lt, best_j));
+			j4 = _mm_add_epi32(j4, _mm_set1_epi32(4));
+		}
+		alignas(16) int32_t bd[4], bj[4];
+		_mm_store_si128((__m128i*) bd, best);
+		_mm_store_si128((__m128i*) bj, best_j);
+		uint32_t c = 0;
+		for (int l = 1; l < 4; ++l) {
+			if (bd[l] < bd[c] || (bd[l] == bd[c] && bj[l] < bj[c])) c = l;
+		}
+		clusters[i] = bj[c];
+	}
+#else
+	for (size_t i = 0; i < data.size(); ++i) {
+		int32_t best = INT32_MAX;
+		for (uint32_t j = 0; j < k; ++j) {
+			int32_t d = 0;
+			for (int c = 0; c < 3; ++c) {
+				int32_t x = means[j][c] - data[i][c];
+				d += x * x;
+			}
+			if (d < best) {
+				best = d;
+				clusters[i] = j;
+			}
+		}
+	}
+#endif
+}
+
+inline int32_t distance_u8(const std::array<uint8_t, 3>& a, const std::array<int16_t, 3>& b) {
+	int32_t d = 0;
+	for (int c = 0; c < 3; ++c) {
+		int32_t x = b[c] - a[c];
+		d += x * x;
+	}
+	return d;
+}
+
+// Lloyd iterations for the integer k-means. returns the final clusters
+inline std::vector<uint32_t> lloyd_u8(const std::vector<std::array<uint8_t, 3>>& data,
+	const std::vector<uint64_t>& weights, std::vector<std::array<int16_t, 3>>& means,
+	const std::vector<bool>& locked, int max_iter, int tol) {
+	const uint32_t n = means.size();
+	std::vector<uint32_t> clusters;
+	for (int it = 0; it < max_iter; ++it) {
+		closest_means_u8(data, means, clusters);
+		std::vector<std::array<uint64_t, 3>> sum(n, {{0, 0, 0}});
+		std::vector<uint64_t> count(n, 0);
+		for (size_t i = 0; i < data.size(); ++i) {
+			count[clusters[i]] += weights[i];
+			for (int c = 0; c < 3; ++c) sum[clusters[i]][c] += weights[i] * data[i][c];
+		}
+		int32_t moved = 0;
+		for (uint32_t j = 0; j < n; ++j) {
+			if (!count[j] || (!locked.empty() && locked[j])) continue;
+			std::array<int16_t, 3> m;
+			for (int c = 0; c < 3; ++c) m[c] = (sum[j][c] + count[j] / 2) / count[j];
+			int32_t d = 0;
+			for (int c = 0; c < 3; ++c) d += (m[c] - means[j][c]) * (m[c] - means[j][c]);
+			moved = std::max(moved, d);
+			means[j] = m;
+		}
+		if (moved <= tol * tol) break;
+	}
+	closest_means_u8(data, means, clusters);
+	return clusters;
+}
+
+} // namespace details
+
+/*
+Weighted k-means for 8 bit data with three channels that has been binned into a histogram: the
+data point i counts as weights[i] points. A point is 3 bytes instead of 12, distances are exact
+integers and means are summed exactly in 64 bits and rounded to integers after every update.
+
+The result only depends on the input: kmeans++ seeding uses a generator with a fixed seed and
+samples by integer cumulative weights instead of std::discrete_distribution, whose output differs
+between standard libraries. Stops when the means repeat, or after max_iter iterations since
+rounding can make Lloyd's algorithm cycle between two solutions.
+
+Returns fewer than k means if there are fewer distinct points with a weight above zero.
+*/
+inline std::tuple<std::vector<std::array<uint8_t, 3>>, std::vector<uint32_t>> kmeans_lloyd(
+	const std::vector<std::array<uint8_t, 3>>& data, const std::vector<uint64_t>& weights, uint32_t k,
+	int max_iter = 100) {
+	assert(weights.size() == data.size());
+	std::vector<std::array<int16_t, 3>> means;
+	std::vector<uint32_t> clusters;
+	uint64_t state = 0x9e3779b97f4a7c15; // splitmix64
+	auto rand = [&state]() {
+		uint64_t z = (state += 0x9e3779b97f4a7c15);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		return z ^ (z >> 31);
+	};
+	// weights are capped for seeding so that weight * distance sums fit in 64 bits
+	auto pick = [&](const std::vector<uint64_t>& w) -> size_t {
+		uint64_t total = 0;
+		for (auto x : w) total += x;
+		if (!total) return data.size();
+		uint64_t r = rand() % total;
+		for (size_t i = 0; i < w.size(); ++i) {
+			if (r < w[i]) return i;
+			r -= w[i];
+		}
+		return data.size();
+	};
+	std::vector<uint64_t> capped(data.size()), w(data.size());
+	for (size_t i = 0; i < data.size(); ++i) capped[i] = std::min<uint64_t>(weights[i], 1u << 20);
+
+	std::vector<int32_t> dist(data.size(), INT32_MAX);
+	for (size_t i = pick(capped); means.size() < k && i < data.size(); i = pick(w)) {
+		means.push_back({{data[i][0], data[i][1], data[i][2]}});
+		for (size_t j = 0; j < data.size(); ++j) {
+			dist[j] = std::min(dist[j], details::distance_u8(data[j], means.back()));
+			w[j] = capped[j] * (uint64_t) dist[j];
+		}
+	}
+
+	std::vector<std::array<uint8_t, 3>> out;
+	if (means.empty()) {
+		return std::make_tuple(out, clusters);
+	}
+	clusters = details::lloyd_u8(data, weights, means, std::vector<bool>(), max_iter, 0);
+	for (auto const& m : means) out.push_back({{(uint8_t) m[0], (uint8_t) m[1], (uint8_t) m[2]}});
+	return std::make_tuple(out, clusters);
+}
+
+/*
+Same, warm started from init instead of kmeans++, like the float version with locked means. Stops
+when no mean moved further than tol, or after max_iter iterations. Means are whole numbers, so tol
+is one too: 0 stops when they repeat, 1 also when a mean moved one step in one channel.
+*/
+inline std::tuple<std::vector<std::array<uint8_t, 3>>, std::vector<uint32_t>> kmeans_lloyd(
+	const std::vector<std::array<uint8_t, 3>>& data, const std::vector<uint64_t>& weights,
+	const std::vector<std::array<uint8_t, 3>>& init, const std::vector<bool>& locked, int max_iter = 100,
+	int tol = 0) {
+	assert(weights.size() == data.size());
+	assert(locked.empty() || locked.size() == init.size());
+	std::vector<std::array<int16_t, 3>> means;
+	for (auto const& m : init) means.push_back({{m[0], m[1], m[2]}});
+	std::vector<std::array<uint8_t, 3>> out;
+	std::vector<uint32_t> clusters;
+	if (means.empty()) {
+		return std::make_tuple(out, clusters);
+	}
+	clusters = details::lloyd_u8(data, weights, means, locked, max_iter, tol);
+	for (auto const& m : means) out.push_back({{(uint8_t) m[0], (uint8_t) m[1], (uint8_t) m[2]}});
+	return std::make_tuple(out, clusters);
+}
+
+/*
+LBG style k-means by splitting, weighted like the above. Produces nested solutions for every k from 1
+to k_max in one run instead of starting over for each k.
+
+Starts from the mean of all points. The cluster with the largest distortion is split in two with a
+2-means over its own points only, so every solution is the previous one plus one split. Whenever k
+reaches a power of two all means are refined with Lloyd's algorithm, warm started from the current
+ones, for at most 'refine' iterations.
+
+Returns a std::tuple containing:
+  0: For each k from 1 up, the k means. Fewer than k_max entries if there are fewer distinct points.
+  1: For each k, the distortion: weighted mean of the squared distance of each point to its mean.
+*/
+template <typename T, size_t N>
+std::tuple<std::vector<std::vector<std::array<T, N>>>, std::vector<double>> kmeans_lbg(
+	const std::vector<std::array<T, N>>& data, const std::vector<T>& weights, uint32_t k_max, int refine = 20) {
+	static_assert(std::is_arithmetic<T>::value && std::is_signed<T>::value,
+		"kmeans_lbg requires the template parameter T to be a signed arithmetic type (e.g. float, double, int)");
+	assert(weights.size() == data.size());
+	std::vector<std::vector<std::array<T, N>>> levels;
+	std::vector<double> distortion;
+	double total = 0;
+	for (auto w : weights) total += w;
+	if (data.empty() || k_max == 0 || total <= 0) {
+		return std::make_tuple(levels, distortion);
+	}
+
+	std::vector<uint32_t> clusters(data.size(), 0);
+	std::vector<std::array<T, N>> means = details::calculate_means(data, weights, clusters, {data[0]}, 1);
+	std::vector<double> cost(1); // per cluster
+
+	auto measure = [&]() {
+		std::fill(cost.begin(), cost.end(), 0.0);
+		for (size_t i = 0; i < data.size(); ++i) {
+			cost[clusters[i]] += weights[i] * (double) details::distance_squared(data[i], means[clusters[i]]);
+		}
+	};
+	measure();
+
+	for (uint32_t k = 1;; ++k) {
+		if (k > 1 && (k & (k - 1)) == 0) {
+			for (int it = 0; it < refine; ++it) {
+				clusters = details::calculate_clusters(data, means);
+				auto old_means = means;
+				means = details::calculate_means(data, weights, clusters, old_means, k);
+				if (means == old_means) break;
+			}
+			clusters = details::calculate_clusters(data, means);
+			measure();
+		}
+		double sum = 0;
+		for (auto c : cost) sum += c;
+		levels.push_back(means);
+		distortion.push_back(sum / total);
+		if (k == k_max) break;
+
+		// split the worst cluster that still has two distinct points
+		std::vector<size_t> order(k);
+		for (size_t c = 0; c < k; ++c) order[c] = c;
+		std::sort(order.begin(), order.end(), [&cost](size_t a, size_t b) { return cost[a] > cost[b]; });
+		bool split = false;
+		for (size_t c : order) {
+			if (cost[c] <= 0) break;
+			std::vector<size_t> members;
+			for (size_t i = 0; i < data.size(); ++i) {
+				if (clusters[i] == c && weights[i] > 0) members.push_back(i);
+			}
+			// seeds: the current mean and the member farthest from it
+			std::array<T, N> a = means[c], b = a;
+			T far = T();
+			for (size_t i : members) {
+				T d = details::distance_squared(data[i], a);
+				if (d > far) {
+					far = d;
+					b = data[i];
+				}
+			}
+			if (far <= T()) continue;
+			std::vector<uint32_t> side(members.size());
+			std::array<T, N> sa, sb;
+			T wa, wb;
+			// members to the nearer of a and b, summed per side. false if a side gets no weight
+			auto assign = [&]() {
+				sa = sb = std::array<T, N>{};
+				wa = wb = T();
+				for (size_t j = 0; j < members.size(); ++j) {
+					auto const& p = data[members[j]];
+					T w = weights[members[j]];
+					side[j] = details::distance_squared(p, b) < details::distance_squared(p, a);
+					auto& s = side[j] ? sb : sa;
+					(side[j] ? wb : wa) += w;
+					for (size_t d = 0; d < N; ++d) s[d] += p[d] * w;
+				}
+				return wa > 0 && wb > 0;
+			};
+			// side always matches the final a and b
+			bool halves = assign();
+			for (int it = 0; halves && it < refine; ++it) {
+				for (size_t d = 0; d < N; ++d) {
+					sa[d] /= wa;
+					sb[d] /= wb;
+				}
+				if (sa == a && sb == b) break;
+				a = sa;
+				b = sb;
+				halves = assign();
+			}
+			// a split that leaves one half empty would waste a mean, try the next cluster
+			if (!halves) continue;
+			means[c] = a;
+			means.push_back(b);
+			cost.push_back(0);
+			for (size_t j = 0; j < members.size(); ++j) {
+				clusters[members[j]] = side[j] ? k : c;
+			}
+			cost[c] = 0;
+			for (size_t j = 0; j < members.size(); ++j) {
+				size_t i = members[j];
+				cost[clusters[i]] += weights[i] * (double) details::distance_squared(data[i], means[clusters[i]]);
+			}
+			split = true;
+			break;
+		}
+		if (!split) break;
+	}
+	return std::make_tuple(levels, distortion);
+}
+
 } // namespace dkm
 
 #endif /* DKM_KMEANS_H */
@@ -0,0 +1,28 @@
+/*
+ * Writes srgb_tables.inc, the transfer function tables that palette.cpp
+ * compiles in. Run it again only if sRGBtoLf/LtosRGBf change:
+ * g++ -O2 -msse4.1 gentables.cpp palette.cpp -o gentables && ./gentables > srgb_tables.inc
+ */
+#include <cstdio>
+#include "palette.h"
+
+static void table(const char *name, float (*f)(float))
+{
+    const int k = 0x8000;
+    const float df = 1.0f / k;
+    float x = 0;
+    printf("#ifdef %s\n", name);
+    for( int i=0; i<k; ++i ) {
+        printf("%d,%c", (int) ( f( x ) * k ), i % 16 == 15 ? '\n' : ' ');
+        x += df;
+    }
+    printf("#endif\n");
+}
+
+int main()
+{
+    printf("// generated by gentables.cpp, do not edit\n");
+    table("SRGB_TO_L", sRGBtoLf);
+    table("L_TO_SRGB", LtosRGBf);
+    return 0;
+}
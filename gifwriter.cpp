@@ -0,0 +1,135 @@
+#include <algorithm>
+#include "gifwriter.h"
+
+static const int hash_size = 5003; // prime, > 4096
+
+static void put16(FILE *f, int x)
+{
+    fputc(x & 0xff, f);
+    fputc(x >> 8 & 0xff, f);
+}
+
+GifWriter::GifWriter(FILE *fp, int ww, int hh, uint32_t const *pal, int n, int transparent)
+    : f(fp), w(ww), h(hh), keys(hash_size), codes(hash_size)
+{
+    int bits = 1;
+    while ((1 << bits) < n) ++bits;
+    min_bits = std::max(bits, 2);
+
+    fwrite("GIF89a", 1, 6, f);
+    put16(f, w);
+    put16(f, h);
+    fputc(0x80 | (bits-1) << 4 | (bits-1), f); // global color table
+    fputc(0, f); // background
+    fputc(0, f); // aspect
+    for( int i=0; i < 1<<bits; ++i ) {
+        uint32_t c = i < n ? pal[i] : 0;
+        fputc(c >> 16 & 0xff, f);
+        fputc(c >> 8 & 0xff, f);
+        fputc(c & 0xff, f);
+    }
+
+    if (transparent >= 0) {
+        // graphic control extension, only for the transparent index
+        fputc(0x21, f);
+        fputc(0xf9, f);
+        fputc(4, f);
+        fputc(1, f);
+        put16(f, 0);
+        fputc(transparent, f);
+        fputc(0, f);
+    }
+
+    // image descriptor
+    fputc(0x2c, f);
+    put16(f, 0);
+    put16(f, 0);
+    put16(f, w);
+    put16(f, h);
+    fputc(0, f);
+    fputc(min_bits, f);
+
+    reset_dict();
+    put_code(1 << min_bits, code_size); // clear
+}
+
+void GifWriter::reset_dict()
+{
+    std::fill(keys.begin(), keys.end(), -1);
+    next_code = (1 << min_bits) + 2;
+    code_size = min_bits + 1;
+}
+
+void GifWriter::flush_block()
+{
+    if (block_len) {
+        fputc(block_len, f);
+        fwrite(block, 1, block_len, f);
+        block_len = 0;
+    }
+}
+
+void GifWriter::put_byte(uint8_t b)
+{
+    block[block_len++] = b;
+    if (block_len == 255) flush_block();
+}
+
+void GifWriter::put_code(int code, int bits)
+{
+    bitbuf |= (uint32_t) code << bitcnt;
+    bitcnt += bits;
+    while (bitcnt >= 8) {
+        put_byte(bitbuf & 0xff);
+        bitbuf >>= 8;
+        bitcnt -= 8;
+    }
+}
+
+bool GifWriter::write_row(uint8_t const *idx)
+{
+    if (y >= h) return false;
+    for( int x=0; x<w; ++x ) {
+        int k = idx[x];
+        if (prefix < 0) {
+            prefix = k;
+            continue;
+        }
+        int32_t key = prefix << 8 | k;
+        int i = key % hash_size;
+        while (keys[i] >= 0 && keys[i] != key)
+            if (++i == hash_size) i = 0;
+        if (keys[i] == key) {
+            prefix = codes[i];
+            continue;
+        }
+        put_code(prefix, code_size);
+        int c = next_code++;
+        keys[i] = key;
+        codes[i] = c;
+        if (c >= 1 << code_size) ++code_size;
+        if (c == 4095) {
+            put_code(1 << min_bits, code_size);
+            reset_dict();
+        }
+        prefix = k;
+    }
+    ++y;
+    return !ferror(f);
+}
+
+bool GifWriter::finish()
+{
+    if (prefix >= 0) {
+        put_code(prefix, code_size);
+        // the decoder adds one more entry after reading the last code
+        if (next_code >= 1 << code_size && code_size < 12) ++code_size;
+    }
+    put_code((1 << min_bits) + 1, code_size); // end of information
+    if (bitcnt > 0) put_byte(bitbuf & 0xff);
+    bitbuf = bitcnt = 0;
+    flush_block();
+    fputc(0, f); // block terminator
+    fputc(0x3b, f); // trailer
+    return y == h && !ferror(f);
+}
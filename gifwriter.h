@@ -0,0 +1,48 @@
+#ifndef GIFWRITER_H
+#define GIFWRITER_H
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include "pipeline.h"
+
+/*
+ * Minimal GIF89a encoder for 8-bit indexed images.
+ * Rows are LZW compressed as they come in, nothing is buffered
+ * except the current 255 byte data sub-block.
+ */
+class GifWriter {
+    FILE *f;
+    int w, h, y = 0;
+    int min_bits;
+
+    // LZW state
+    std::vector<int32_t> keys; // (prefix << 8 | pixel), -1 if empty
+    std::vector<int16_t> codes;
+    int prefix = -1;
+    int next_code, code_size;
+    uint32_t bitbuf = 0;
+    int bitcnt = 0;
+    uint8_t block[256];
+    int block_len = 0;
+
+    void put_byte(uint8_t b);
+    void put_code(int code, int bits);
+    void reset_dict();
+    void flush_block();
+
+public:
+    // pal: 0xRRGGBB colors. n: 1..256. transparent: index shown as clear, or -1
+    GifWriter(FILE *fp, int w, int h, uint32_t const *pal, int n, int transparent=-1);
+    bool write_row(uint8_t const *idx);
+    bool finish(); // writes the trailer. call after the last row
+};
+
+class GifSink : public ScanlineSink {
+    GifWriter gif;
+public:
+    GifSink(FILE *fp, int w, int h, uint32_t const *pal, int n) : gif(fp, w, h, pal, n) {}
+    bool write(int, uint32_t const *, uint8_t const *idx) { return gif.write_row(idx); }
+    bool finish() { return gif.finish(); }
+};
+
+#endif // GIFWRITER_H
@@ -0,0 +1,331 @@
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include <QColor>
+#include "histogram.h"
+#include "trace.h"
+#include "dkm.hpp"
+
+/*
+ * Color -> weight. Open addressing with linear probing, at most half full.
+ * Keys are 24 bit colors, so ~0 marks a free slot
+ */
+class ColorCounts {
+    static const uint32_t FREE = ~0u;
+    std::vector<uint32_t> key;
+    std::vector<uint64_t> val;
+    int log2;
+    size_t used = 0;
+
+    uint32_t slot(uint32_t k) const
+    {
+        uint32_t m = key.size() - 1;
+        uint32_t i = k * 2654435761u >> ( 32 - log2 ); // fibonacci hashing
+        while (key[i] != k && key[i] != FREE)
+            i = ( i + 1 ) & m;
+        return i;
+    }
+
+    void grow()
+    {
+        std::vector<uint32_t> k0(1u << ++log2, FREE);
+        std::vector<uint64_t> v0(k0.size(), 0);
+        key.swap(k0);
+        val.swap(v0);
+        for( size_t i=0; i<k0.size(); ++i ) {
+            if (k0[i] == FREE) continue;
+            uint32_t j = slot(k0[i]);
+            key[j] = k0[i];
+            val[j] = v0[i];
+        }
+    }
+
+public:
+    explicit ColorCounts(int l=12) : key(1u << l, FREE), val(1u << l, 0), log2(l) {}
+
+    void add(uint32_t k, uint64_t w)
+    {
+        uint32_t i = slot(k);
+        if (key[i] == FREE) {
+            if (2 * ( used + 1 ) > key.size()) {
+                grow();
+                i = slot(k);
+            }
+            key[i] = k;
+            ++used;
+        }
+        val[i] += w;
+    }
+
+    void merge(ColorCounts const &o)
+    {
+        for( size_t i=0; i<o.key.size(); ++i )
+            if (o.key[i] != FREE) add(o.key[i], o.val[i]);
+    }
+
+    template<typename F>
+    void each(F f) const
+    {
+        for( size_t i=0; i<key.size(); ++i )
+            if (key[i] != FREE) f(key[i], val[i]);
+    }
+
+    size_t size() const { return used; }
+};
+
+// reads pixels as 0xRRGGBB from the formats we keep images in, without a copy
+static void count_rows(QImage const &img, QImage const &mask, uint32_t keep, int y0, int y1, ColorCounts &t)
+{
+    const int w = img.width();
+    const bool bytes = img.format() == QImage::Format_RGBX8888 || img.format() == QImage::Format_RGBA8888;
+    for( int y=y0; y<y1; ++y ) {
+        uint8_t const *m = mask.isNull() ? nullptr : mask.constScanLine(y);
+        uint8_t const *p = img.constScanLine(y);
+        auto px = [&](int x) -> uint32_t {
+            if (bytes) return p[4*x] << 16 | p[4*x+1] << 8 | p[4*x+2];
+            return ((uint32_t const*) p)[x] & 0xffffff;
+        };
+        if (m) {
+            for( int x=0; x<w; ++x )
+                if (m[x]) t.add(px(x) & keep, m[x]);
+            continue;
+        }
+        // flat areas are common, count runs
+        for( int x=0; x<w; ) {
+            uint32_t c = px(x) & keep;
+            int x0 = x;
+            while (++x < w && ( px(x) & keep ) == c);
+            t.add(c, x - x0);
+        }
+    }
+}
+
+Histogram::Histogram(QImage const &img0, int b, QImage const &mask, ThreadPool *pool)
+{
+    TRACE_SCOPE("histogram");
+    bits = std::min(std::max(b, 1), 8);
+    QImage img = img0;
+    switch (img.format()) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGBA8888:
+        break;
+    default:
+        img = img.convertToFormat(QImage::Format_RGB32);
+    }
+    const int h = img.height();
+    if (!h || !img.width()) return;
+    QImage m = mask;
+    if (m.isNull() && img.hasAlphaChannel())
+        m = img.convertToFormat(QImage::Format_Alpha8); // clear pixels don't count
+    bool use_mask = !m.isNull() && m.size() == img.size()
+        && ( m.format() == QImage::Format_Grayscale8 || m.format() == QImage::Format_Alpha8 );
+
+    const uint32_t c = 0xff << ( 8 - bits ) & 0xff;
+    const uint32_t keep = c << 16 | c << 8 | c;
+
+    std::unique_ptr<ThreadPool> own;
+    if (!pool) {
+        own.reset(new ThreadPool);
+        pool = own.get();
+    }
+    int bands = std::min(pool->size(), h);
+    std::vector<ColorCounts> t(bands);
+    std::vector<std::future<void>> jobs;
+    for( int i=0; i<bands; ++i ) {
+        int y0 = h * i / bands, y1 = h * ( i + 1 ) / bands;
+        jobs.push_back(pool->submit([&, i, y0, y1]() {
+            count_rows(img, use_mask ? m : QImage(), keep, y0, y1, t[i]);
+        }));
+    }
+    for( auto &j : jobs ) j.get();
+
+    for( int i=1; i<bands; ++i )
+        t[0].merge(t[i]);
+
+    // report the middle of each bin
+    const uint32_t half = bits < 8 ? 0x808080 >> bits : 0;
+    bins.reserve(t[0].size());
+    t[0].each([this, half](uint32_t k, uint64_t v) {
+        bins.push_back({k | half, v});
+        total += v;
+    });
+    std::sort(bins.begin(), bins.end(), [](Bin const &a, Bin const &b) { return a.rgb < b.rgb; });
+}
+
+Histogram Histogram::reduced(int b) const
+{
+    b = std::min(std::max(b, 1), bits);
+    if (b == bits) return *this;
+    TRACE_SCOPE("histogram reduce");
+    const uint32_t c = 0xff << ( 8 - b ) & 0xff;
+    const uint32_t keep = c << 16 | c << 8 | c;
+    const uint32_t half = 0x808080 >> b;
+    ColorCounts t;
+    for( auto const &bin : bins )
+        t.add(bin.rgb & keep, bin.weight);
+    Histogram r;
+    r.bits = b;
+    r.total = total;
+    r.bins.reserve(t.size());
+    t.each([&r, half](uint32_t k, uint64_t v) { r.bins.push_back({k | half, v}); });
+    std::sort(r.bins.begin(), r.bins.end(), [](Bin const &x, Bin const &y) { return x.rgb < y.rgb; });
+    return r;
+}
+
+static void points(Histogram const &h, std::vector<std::array<float,3>> &data, std::vector<float> &weight)
+{
+    for( auto const &b : h.bins ) {
+        float r = b.rgb >> 16, g = b.rgb >> 8 & 0xff, bl = b.rgb & 0xff;
+        data.push_back({{r,g,bl}});
+        weight.push_back(b.weight);
+    }
+}
+
+static uint32_t pack(std::array<float,3> const &m)
+{
+    auto c = [](float x) { return (uint32_t) std::min(std::max(x + 0.5f, 0.0f), 255.0f); };
+    return c(m[0]) << 16 | c(m[1]) << 8 | c(m[2]);
+}
+
+// bins are 8 bit colors, so the integer k-means fits. 3 bytes a point
+static void points(Histogram const &h, std::vector<std::array<uint8_t,3>> &data, std::vector<uint64_t> &weight)
+{
+    for( auto const &b : h.bins ) {
+        data.push_back({{(uint8_t) ( b.rgb >> 16 ), (uint8_t) ( b.rgb >> 8 ), (uint8_t) b.rgb}});
+        weight.push_back(b.weight);
+    }
+}
+
+std::vector<uint32_t> kmeans_palette(Histogram const &h, int n)
+{
+    std::vector<std::array<uint8_t,3>> data;
+    std::vector<uint64_t> weight;
+    points(h, data, weight);
+    std::vector<uint32_t> pal;
+    if (n <= 0 || data.empty()) return pal;
+    auto mc = [&]() {
+        TRACE_SCOPE("kmeans");
+        return dkm::kmeans_lloyd(data, weight, n);
+    }();
+    for( auto const &m : std::get<0>(mc) )
+        pal.push_back(m[0] << 16 | m[1] << 8 | m[2]);
+    return pal;
+}
+
+std::vector<uint32_t> kmeans_palette(Histogram const &h, std::vector<uint32_t> const &pal, std::vector<bool> const &locked)
+{
+    std::vector<std::array<float,3>> data;
+    std::vector<float> weight;
+    points(h, data, weight);
+    if (data.empty() || pal.empty()) return pal;
+    std::vector<std::array<float,3>> init;
+    for( uint32_t c : pal ) {
+        float r = c >> 16 & 0xff, g = c >> 8 & 0xff, b = c & 0xff;
+        init.push_back({{r,g,b}});
+    }
+    std::vector<bool> fixed = locked;
+    fixed.resize(pal.size(), false);
+    auto mc = [&]() {
+        TRACE_SCOPE("kmeans_locked");
+        return dkm::kmeans_lloyd(data, weight, init, fixed);
+    }();
+    std::vector<uint32_t> out;
+    for( size_t i=0; i<pal.size(); ++i )
+        out.push_back(fixed[i] ? pal[i] : pack(std::get<0>(mc)[i]));
+    return out;
+}
+
+std::vector<uint32_t> refine_palette(Histogram const &h, std::vector<uint32_t> const &pal, int from_bits,
+    std::vector<bool> const &locked, int max_iter, int tol)
+{
+    TRACE_SCOPE("refine_palette");
+    if (pal.empty() || h.empty()) return pal;
+    std::vector<std::array<uint8_t,3>> means;
+    for( uint32_t c : pal )
+        means.push_back({{(uint8_t) ( c >> 16 ), (uint8_t) ( c >> 8 ), (uint8_t) c}});
+    for( int b=std::min(from_bits + 1, h.bits); b<=h.bits; ++b ) {
+        Histogram level;
+        Histogram const &l = b == h.bits ? h : ( level = h.reduced(b) );
+        std::vector<std::array<uint8_t,3>> data;
+        std::vector<uint64_t> weight;
+        points(l, data, weight);
+        means = std::get<0>(dkm::kmeans_lloyd(data, weight, means, locked, max_iter, tol));
+    }
+    std::vector<uint32_t> out;
+    for( auto const &m : means )
+        out.push_back(m[0] << 16 | m[1] << 8 | m[2]);
+    return out;
+}
+
+std::vector<uint32_t> kmeans_pyramid(Histogram const &h, int n, int coarse_bits)
+{
+    coarse_bits = std::min(coarse_bits, h.bits);
+    return refine_palette(h, kmeans_palette(h.reduced(coarse_bits), n), coarse_bits);
+}
+
+PaletteLadder::PaletteLadder(Histogram const &h, int k_max)
+{
+    TRACE_SCOPE("kmeans_lbg");
+    std::vector<std::array<float,3>> data;
+    std::vector<float> weight;
+    points(h, data, weight);
+    auto res = dkm::kmeans_lbg(data, weight, std::max(k_max, 1));
+    for( auto const &means : std::get<0>(res) ) {
+        pals.emplace_back();
+        for( auto const &m : means )
+            pals.back().push_back(pack(m));
+    }
+    for( double d : std::get<1>(res) )
+        rms.push_back(std::sqrt(d));
+}
+
+std::vector<uint32_t> const &PaletteLadder::get(int k) const
+{
+    static const std::vector<uint32_t> none;
+    if (pals.empty()) return none;
+    return pals[std::min(std::max(k, 1), max_k()) - 1];
+}
+
+int PaletteLadder::smallest_k(double max_rms) const
+{
+    for( size_t i=0; i<rms.size(); ++i )
+        if (rms[i] <= max_rms) return i + 1;
+    return max_k();
+}
+
+QImage render_histogram(Histogram const &h, int w, int ht)
+{
+    const int gw = std::max(w / 32, 2); // gray strip
+    std::vector<uint64_t> sum(w * ht, 0), best(w * ht, 0);
+    std::vector<QRgb> col(w * ht, 0);
+    uint64_t top = 1;
+
+    for( auto const &b : h.bins ) {
+        QColor c(b.rgb);
+        int hue = c.hue();
+        int x = hue < 0 ? 0 : gw + hue * ( w - gw - 1 ) / 359;
+        int y = ( 255 - c.lightness() ) * ( ht - 1 ) / 255;
+        int i = y * w + x;
+        sum[i] += b.weight;
+        top = std::max(top, sum[i]);
+        if (b.weight > best[i]) {
+            best[i] = b.weight;
+            col[i] = b.rgb;
+        }
+    }
+
+    QImage img(w, ht, QImage::Format_RGB32);
+    double s = 1.0 / std::log1p((double) top);
+    for( int y=0; y<ht; ++y ) {
+        auto d = (QRgb*) img.scanLine(y);
+        for( int x=0; x<w; ++x ) {
+            int i = y * w + ( x < gw ? 0 : x ); // grays are counted in column 0
+            double v = sum[i] ? 0.25 + 0.75 * std::log1p((double) sum[i]) * s : 0;
+            d[x] = qRgb(qRed(col[i]) * v, qGreen(col[i]) * v, qBlue(col[i]) * v);
+        }
+        if (gw < w) d[gw-1] = qRgb(64, 64, 64); // separator
+    }
+    return img;
+}
@@ -0,0 +1,86 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <QImage>
+#include "threadpool.h"
+
+/*
+ * Sparse color histogram of an image.
+ * Built in parallel: every thread counts a band of rows into its own open
+ * addressing hash table keyed on the packed 24 bit color, then the tables
+ * are merged. Palette generators and the histogram view read from this
+ * instead of walking the image again.
+ */
+class Histogram {
+public:
+    struct Bin {
+        uint32_t rgb; // 0xRRGGBB. the center of the bin when bits < 8
+        uint64_t weight; // number of pixels, or sum of their mask values
+    };
+    std::vector<Bin> bins; // sorted by rgb
+    uint64_t total = 0; // sum of all weights
+    int bits = 8;
+
+    Histogram() {}
+
+    /*
+    bits: precision per channel, 1 to 8. fewer bits merge similar colors
+    mask: optional per pixel weights. Format_Grayscale8, same size as img.
+    without one every pixel weighs 1, or its alpha if img has alpha
+    pool: where to run. a temporary pool is made when null
+    */
+    Histogram(QImage const &img, int bits=8, QImage const &mask=QImage(), ThreadPool *pool=nullptr);
+
+    bool empty() const { return bins.empty(); }
+
+    // the same counts at a lower precision. bins are merged, the image isn't read again
+    Histogram reduced(int bits) const;
+};
+
+// weighted k-means over the bins. at most n colors, 0xRRGGBB.
+// integer arithmetic and a fixed seed, so the same histogram always gives the same palette
+std::vector<uint32_t> kmeans_palette(Histogram const &h, int n);
+
+// same, starting from pal. entries where locked[i] is set are kept as they are
+std::vector<uint32_t> kmeans_palette(Histogram const &h, std::vector<uint32_t> const &pal, std::vector<bool> const &locked);
+
+/*
+ * Coarse to fine refinement. pal was made from h.reduced(from_bits); each
+ * finer precision up to h.bits warm starts from the one before with at most
+ * max_iter Lloyd iterations, and stops early once no color moves more than
+ * tol, a distance in whole 8 bit RGB units since the colors are rounded to
+ * integers after every step. 1 allows one step in one channel, 0 runs until
+ * the colors repeat. The coarse levels have few bins, so this is close to
+ * the cost of clustering them, and ends up close to clustering h directly.
+ * locked entries are kept as they are
+ */
+std::vector<uint32_t> refine_palette(Histogram const &h, std::vector<uint32_t> const &pal, int from_bits,
+    std::vector<bool> const &locked=std::vector<bool>(), int max_iter=4, int tol=1);
+
+// kmeans_palette on h.reduced(coarse_bits), then refine_palette
+std::vector<uint32_t> kmeans_pyramid(Histogram const &h, int n, int coarse_bits=5);
+
+/*
+ * Palettes of every size from one LBG run over the bins, see dkm::kmeans_lbg.
+ * Each is the previous one with one color split in two, so picking a size
+ * is a lookup
+ */
+struct PaletteLadder {
+    std::vector<std::vector<uint32_t>> pals; // pals[k-1] has k colors, 0xRRGGBB
+    std::vector<double> rms; // distance of a pixel to its color, 8 bit RGB units
+
+    PaletteLadder() {}
+    explicit PaletteLadder(Histogram const &h, int k_max=256);
+
+    int max_k() const { return pals.size(); }
+    std::vector<uint32_t> const &get(int k) const; // k is clamped to 1..max_k()
+    int smallest_k(double max_rms) const; // fewest colors within the error. max_k() if none is
+};
+
+// hue across, lightness down, grays in a strip on the left.
+// brighter means more weight, on a log scale
+QImage render_histogram(Histogram const &h, int w, int ht);
+
+#endif // HISTOGRAM_H
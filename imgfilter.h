@@ -21,10 +21,12 @@ QImage filter_rgb(QImage const &src, F f)
     return dst;
 }
 
+// dst is reused when it has the right size and format
 template<typename FR, typename FG, typename FB, typename FA>
-QImage filter2(QImage const &src, FR fr, FG fg, FB fb, FA fa)
+void filter2_into(QImage const &src, QImage &dst, FR fr, FG fg, FB fb, FA fa)
 {
-    QImage dst(src.size(), src.format());
+    if (dst.size() != src.size() || dst.format() != src.format())
+        dst = QImage(src.size(), src.format());
     int y, x, w=src.width()*4, h=src.height();
     for( y=0; y<h; ++y ) {
         uchar const *s = src.scanLine(y);
@@ -36,6 +38,13 @@ QImage filter2(QImage const &src, FR fr, FG fg, FB fb, FA fa)
             d[x+3] = fa( s[x+3] << 7 ) >> 7;
         }
     }
+}
+
+template<typename FR, typename FG, typename FB, typename FA>
+QImage filter2(QImage const &src, FR fr, FG fg, FB fb, FA fa)
+{
+    QImage dst;
+    filter2_into(src, dst, fr, fg, fb, fa);
     return dst;
 }
 
@@ -44,4 +53,20 @@ template<typename F> QImage filter(QImage const &src, F f)
     return filter2<F>(src,f,f,f,f);
 }
 
+// Indexed8 to RGB32, or ARGB32 if the color table has alpha. dst is reused if it fits
+inline void expand_indexed(QImage const &src, QImage &dst)
+{
+    auto f = src.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32;
+    if (dst.size() != src.size() || dst.format() != f)
+        dst = QImage(src.size(), f);
+    auto tab = src.colorTable();
+    int y, x, w=src.width(), h=src.height();
+    for( y=0; y<h; ++y ) {
+        uchar const *s = src.constScanLine(y);
+        auto d = (QRgb*) dst.scanLine(y);
+        for( x=0; x<w; x++ )
+            d[x] = tab[s[x]];
+    }
+}
+
 #endif // IMGFILTER_H
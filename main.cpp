@@ -2,9 +2,12 @@
 #include <QApplication>
 #include "palettem.h"
 
+int cli_main(int argc, char *argv[]); // cli.cpp
+
 int main(int argc, char *argv[])
 {
-    make_tables();
+    if (argc > 1 && argv[1][0] == '-')
+        return cli_main(argc, argv);
     QApplication a(argc, argv);
     MainWin w;
     w.show();
@@ -1,5 +1,6 @@
 ﻿#include <cmath>
 #include <cassert>
+#include <algorithm>
 #include <iostream>
 #include <QFileDialog>
 #include <QStandardPaths>
@@ -9,74 +10,24 @@
 #include <QPixmap>
 #include <QMessageBox>
 #include <QScrollBar>
+#include <QStatusBar>
+#include <QFile>
+#include <QPainter>
+#include <QListWidget>
+#include <QSignalBlocker>
+#include <QScreen>
+#include <QWindow>
+#include <QCursor>
 #include "mainwin.h"
 #include "ui_mainwin.h"
 #include "palettem.h"
 #include "vec3.h"
-#include "dithered.h"
+#include "quantize.h"
+#include "palfile.h"
+#include "histogram.h"
+#include "palorder.h"
 #include "imgfilter.h"
-#include "dkm.hpp"
-
-int pack(ivec3 v) {
-    int b = 8, m = 255;
-    v = v >> 7 & m;
-    return v.s[2] | v.s[1] << b | v.s[0] << 2*b;
-}
-
-ivec3 unpack(int c) {
-    int b = 8, m = 255;
-    return ivec3( c >> 2*b, c >> b, c ) & m << 7;
-}
-
-// quantize a color
-static ivec3 qn3(ivec3 x)
-{
-    return the_pal_iv[map_palette(x)];
-}
-
-template<typename T>
-auto dither_ed(QImage const &p)
-{
-    T ed(p.width());
-    return filter_rgb( p,
-        [&ed] (int r, int g, int b)
-        {
-            auto c0 = ivec3(r,g,b).lookup(sRGBtoL_table);
-            auto c1 = ed.pixel(c0,qn3);
-            auto c2 = (c1 & 0x7fff).lookup(LtosRGB_table);
-            return pack(c2);
-        }
-    );
-}
-
-auto simple_q(QImage const &p)
-{
-    return filter_rgb( p, [](int r, int g, int b) {
-        auto x0 = ivec3(r,g,b).lookup(sRGBtoL_table);
-        auto x1 = qn3(x0).lookup(LtosRGB_table);
-        return pack(x1);
-    });
-}
-
-
-static const QStringList qfun_names({
-"None",
-"Floyd-Steinberg",
-"Jarvis Judice Ninke",
-"Sierra 3-row",
-"Sierra 2-row",
-// "Sierra Lite",
-});
-
-typedef QImage (*QuantizerFunc)(QImage const&);
-static const QuantizerFunc qfun[] = {
-simple_q,
-dither_ed<DitherFS>,
-dither_ed<DitherJJN>,
-dither_ed<DitherS3>,
-dither_ed<DitherS2>,
-// dither_ed<DitherSL>,
-};
+#include "trace.h"
 
 static const struct {
     QString header, footer, fmt;
@@ -121,10 +72,14 @@ MainWin::MainWin(QWidget *parent) :
     ui(new Ui::MainWin)
 {
     ui->setupUi(this);
+    qctx.pool = &pool;
     ui->dit_mode->addItems(qfun_names);
     ui->exp_preset->addItems(fmt_preset_names);
     ui->tbpal->setModel(new PaletteM(this));
     ui->hsplit3->setSizes({20,80,20});
+    sample_timer.setSingleShot(true);
+    connect(&sample_timer, &QTimer::timeout, this, &MainWin::sampleMove);
+    since_sample.start();
     load_src("img/uyryd.jpg");
     scaleSrc();
 }
@@ -143,9 +98,30 @@ void MainWin::refreshTable()
     m->dataChanged(m->index(1,1),m->index(m->columnCount(),m->rowCount())); // repaint the color table
 }
 
+// the palette of n colors came from the ladder and was not edited since
+bool MainWin::fromLadder(int n)
+{
+    if (n <= 0 || !ladder.valid() || ladder.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+    auto const &p = generated;
+    if ((int) p.size() != n) return false;
+    for( int i=0; i<n; ++i )
+        if ((the_pal[i].rgb() & 0xffffff) != p[i]) return false;
+    return true;
+}
+
 void MainWin::setColorCount(int x)
 {
+    int old = the_pal_c;
     the_pal_c = x < 0 ? 0 : ( x > 256 ? 256 : x );
+    if (the_pal_c != old && fromLadder(old)) {
+        // follow the spinner with the precomputed palette of the new size.
+        // not refined, that would make the spinner lag
+        auto const &p = ladder.get().get(the_pal_c);
+        for( size_t i=0; i<p.size(); ++i )
+            set_color(i, QColor(p[i]));
+        generated = p;
+    }
     refreshTable();
     preview(); // palette changed, thus preview image also changed
 }
@@ -172,17 +148,9 @@ static void initializeImageFileDialog(QFileDialog &dialog, QFileDialog::AcceptMo
         dialog.setDefaultSuffix("jpg");
 }
 
-/*
- * gamma-correct scaling
- * use nearest scaling when upscaling, linear? filter when downscaling
- */
-auto gscaled(QImage const &i, int w, int h, Qt::AspectRatioMode m, int smooth=1)
-{
-    auto t = smooth ? //i.width() > w || i.height() > h ?
-    Qt::SmoothTransformation : Qt::FastTransformation;
-    //w &= ~3; h &= ~3;
-    return filter(filter(i,sRGBtoL).scaled(w,h,m,t),LtosRGB);
-}
+// palettes are clustered at 5 bits per channel, at most 32K bins, which keeps
+// k-means quick. then refined on the full 8 bits, see refine_palette
+static const int coarse_bits = 5;
 
 bool MainWin::load_src(const QString &fileName)
 {
@@ -191,7 +159,12 @@ bool MainWin::load_src(const QString &fileName)
     // auto-rotate jpegs if metadata says so
     reader.setAutoTransform(true);
 #endif
-    QImage newImage = reader.read();
+    TRACE_SCOPE("load_src");
+    QImage newImage;
+    {
+        TRACE_SCOPE("decode");
+        newImage = reader.read();
+    }
     if (newImage.isNull()) {
         QMessageBox::information(this,
 QGuiApplication::applicationDisplayName(),
@@ -200,6 +173,13 @@ tr("Cannot load %1: %2")
         return false;
     }
 
+    // count colors at full resolution, off the GUI thread
+    hist = bg.submit([newImage]() { return Histogram(newImage); }).share();
+    when_ready(hist, "updateHistView");
+    // then palettes of every size, for genHist and the color count spinner
+    ladder = bg.submit([h = hist]() { return PaletteLadder(h.get().reduced(coarse_bits)); }).share();
+    updateHistView();
+
     int r = 500;
     if (newImage.width() > r || newImage.height() > r) {
         newImage = gscaled(newImage, r, r, Qt::KeepAspectRatio);
@@ -207,20 +187,51 @@ tr("Cannot load %1: %2")
         << newImage.width() << 'x' << newImage.height() << '\n';
     }
 
-    img_src = newImage.convertToFormat(QImage::Format_RGBX8888);
+    img_src = newImage.convertToFormat(newImage.hasAlphaChannel()
+        ? QImage::Format_RGBA8888 : QImage::Format_RGBX8888);
     return true;
 }
 
-static void setImg(QLabel *la, QImage const &im)
+// the Palette is rebuilt only after an edit. for gray palettes that fills
+// a table of every gray level, too slow to repeat on every redraw
+QuantizerContext const &MainWin::context()
+{
+    if (pal_rev != the_pal_rev || pal_c != the_pal_c) {
+        qctx.pal = palette_from(the_pal, the_pal_c);
+        pal_rev = the_pal_rev;
+        pal_c = the_pal_c;
+    }
+    return qctx;
+}
+
+QuantizerContext MainWin::job_context()
+{
+    QuantizerContext c = context();
+    c.pool = &job_pool;
+    return c;
+}
+
+// buf keeps the intermediates, so redrawing at the same size doesn't allocate them again
+static QImage setImg(QLabel *la, QImage const &src, ScaleBuffers &buf)
 {
     int w = la->width(), h = la->height();
-    la->setPixmap(QPixmap::fromImage(gscaled(im,w,h,Qt::KeepAspectRatio)));
+    QImage const *im = &src;
+    if (src.format() == QImage::Format_Indexed8) {
+        expand_indexed(src, buf.rgb);
+        im = &buf.rgb;
+    }
+    QImage s = gscaled(*im,w,h,Qt::KeepAspectRatio,1,&buf);
+    TRACE_SCOPE("fromImage");
+    la->setPixmap(QPixmap::fromImage(s));
+    return s;
 }
 
 void MainWin::scaleSrc()
 {
+    TRACE_SCOPE("scaleSrc");
     if (!img_src.isNull()) {
-        setImg(ui->srv_view, img_src);
+        view_src = QImage(); // let go of src_buf so it can be reused
+        view_src = setImg(ui->srv_view, img_src, src_buf);
         preview();
     }
 
@@ -238,37 +249,71 @@ void MainWin::open()
     scaleSrc();
 }
 
-void MainWin::resizeEvent(QResizeEvent *ev)
+void MainWin::saveOutput()
 {
-    (void) ev;
-    scaleSrc();
+    if (img_src.isNull()) return;
+    QString path = QFileDialog::getSaveFileName(this, tr("Save dithered image"),
+        QString(), tr("PNG image (*.png);;GIF image (*.gif)"));
+    if (path.isEmpty()) return;
+    if (!saveIndexed(quantizeImg(job_context(), img_src, dither_method), path)) {
+        QMessageBox::information(this,
+QGuiApplication::applicationDisplayName(),
+tr("Cannot write %1").arg(QDir::toNativeSeparators(path)));
+    }
 }
 
-static QImage quantizeImg(QImage const &p, int mode)
+void MainWin::resizeEvent(QResizeEvent *ev)
 {
-    return qfun[mode](p);
+    (void) ev;
+    scaleSrc();
 }
 
 void MainWin::preview()
 {
     if (img_src.isNull()) return;
+    view_out = QImage(); // let go of out_buf
     //int ss = ui->srv_view->width() * ui->srv_view->height();
     //int is = img_src.width() * img_src.height();
-    if ( ui->dit_ss->isChecked() ) {
-        // dither in screen space
-        auto p = ui->srv_view->pixmap()->toImage();
-        ui->out_view->setPixmap(QPixmap::fromImage(quantizeImg(p, dither_method)));
-    } else {
-        // dither in image space
-        setImg(ui->out_view, quantizeImg(img_src, dither_method));
+    {
+        TRACE_SCOPE("preview");
+        if ( ui->dit_ss->isChecked() ) {
+            // dither in screen space
+            view_out = quantizeImg(context(), view_src, dither_method);
+            TRACE_SCOPE("fromImage");
+            ui->out_view->setPixmap(QPixmap::fromImage(view_out));
+        } else {
+            // dither in image space
+            view_out = setImg(ui->out_view, quantizeImg(context(), img_src, dither_method), out_buf);
+        }
     }
+#ifdef MANPAL_TRACE
+    statusBar()->showMessage(QString::fromStdString(trace_frame()));
+#endif
+}
+
+// pixel of img under the global position g. img is what la shows, centered
+static bool view_pixel(QLabel const *la, QImage const &img, QPoint g, QRgb &px)
+{
+    if (img.isNull() || !la->isVisible()) return false;
+    QPoint l = la->mapFromGlobal(g);
+    QRect r = la->contentsRect();
+    if (!r.contains(l)) return false;
+    QPoint p = l - r.topLeft() - QPoint(( r.width() - img.width() ) / 2, ( r.height() - img.height() ) / 2);
+    if (!img.rect().contains(p)) return false;
+    px = img.pixel(p);
+    return true;
 }
 
+// over the views the color comes from the images they show. only elsewhere
+// is the window rendered again to read it
 QColor MainWin::sample()
 {
     auto a = window()->cursor().pos();
-    auto g = this->grab(QRect(this->mapFromGlobal(a),QSize(1,1)));
-    auto x = g.toImage().pixel(0,0);
+    QRgb x;
+    if (!view_pixel(ui->srv_view, view_src, a, x) && !view_pixel(ui->out_view, view_out, a, x)) {
+        auto g = this->grab(QRect(this->mapFromGlobal(a),QSize(1,1)));
+        x = g.toImage().pixel(0,0);
+    }
     auto c = QColor(x);
     ui->color_box->setStyleSheet(QString("background-color: %1;").arg(c.name()));
     sampled_color = c;
@@ -302,19 +347,21 @@ void MainWin::keyPressEvent(QKeyEvent *e)
     }
 }
 
-void MainWin::mouseMoveEvent(QMouseEvent *e)
+void MainWin::mouseMoveEvent(QMouseEvent *)
 {
-#if 0
-    static int x0=-100, y0=-100;
-    int x = e->x(), y = e->y();
-    int dx = x-x0;
-    int dy = y-y0;
-    if ( dx*dx + dy*dy > 7 ) x0=x, y0=y,
-#endif
+    // moves between frames are folded into one sample at the last position
+    if (sample_timer.isActive()) return;
+    QScreen *scr = windowHandle() ? windowHandle()->screen() : QGuiApplication::primaryScreen();
+    qreal hz = scr && scr->refreshRate() > 1 ? scr->refreshRate() : 60;
+    qint64 frame = (qint64) ( 1000 / hz );
+    sample_timer.start((int) std::max<qint64>(0, frame - since_sample.elapsed()));
+}
+
+void MainWin::sampleMove()
+{
+    since_sample.restart();
     sample();
-    if (live_edit_on){
-        setColor();
-    }
+    if (live_edit_on) setColor();
 }
 
 void MainWin::addColor()
@@ -330,6 +377,16 @@ void MainWin::addColor()
     }
 }
 
+// maps fully transparent pixels of RGBA images
+void MainWin::addTransparent()
+{
+    if ( the_pal_c < 256 ) {
+        add_color(QColor(0, 0, 0, 0));
+        refreshTable();
+        preview();
+    }
+}
+
 void MainWin::delColors()
 {
     PaletteM *m = static_cast<PaletteM*>(ui->tbpal->model());
@@ -352,7 +409,7 @@ void MainWin::colorEditMode(bool on)
 
 void MainWin::setDitherE(int x)
 {
-    ed_err_fract=x;
+    qctx.err_fract=x;
     ui->dit_ed_fract2->setValue(x);
     preview();
 }
@@ -363,9 +420,48 @@ void MainWin::resetDitherE()
     setDitherE(1024);
 }
 
-void MainWin::sortColors()
+// the_pal entries selected in the table. empty if there are none
+std::vector<bool> MainWin::selectedColors()
 {
-    sort_palette();
+    PaletteM *m = static_cast<PaletteM*>(ui->tbpal->model());
+    std::vector<bool> sel(the_pal_c, false);
+    bool any = false;
+    for( auto i : ui->tbpal->selectionModel()->selectedIndexes() ) {
+        int j = m->getidx(i);
+        if (j < the_pal_c) sel[j] = any = true;
+    }
+    if (!any) sel.clear();
+    return sel;
+}
+
+// sorts the selected colors, or all when fewer than two are selected
+void MainWin::sortBy(int key)
+{
+    auto sel = selectedColors();
+    if (std::count(sel.begin(), sel.end(), true) < 2) sel.clear();
+    sort_palette(key, sel);
+    refreshTable();
+    preview();
+}
+
+void MainWin::sortColors() { sortBy(SORT_HUE); }
+void MainWin::sortByLuma() { sortBy(SORT_LUMA); }
+void MainWin::sortHilbert() { sortBy(SORT_HILBERT); }
+
+// reorders the palette so that the output compresses better, see palorder.h.
+// the order is computed from the current output. Palette::map breaks ties
+// toward the lowest index, so colors at equal distance may swap afterwards
+void MainWin::compactOrder()
+{
+    if (img_src.isNull() || the_pal_c < 3) return;
+    auto order = compact_order(quantizeImg(job_context(), img_src, dither_method));
+    if ((int) order.size() != the_pal_c) return;
+    QColor old[256];
+    std::copy(the_pal, the_pal + the_pal_c, old);
+    for( int i=0; i<the_pal_c; ++i )
+        set_color(i, old[order[i]]);
+    refreshTable();
+    preview();
 }
 
 #define tdoc(xxx) ui->xxx->document()
@@ -393,7 +489,29 @@ void MainWin::exp_msg()
 
 void MainWin::exp_file()
 {
-    exp_msg();
+    QString path = tdoc(exp_filepath)->toPlainText().trimmed();
+    if (path.isEmpty()) {
+        path = QFileDialog::getSaveFileName(this, tr("Export palette"), QString(),
+tr("Text (*.txt);;GIMP palette (*.gpl);;PNG palette (*.png);;Adobe color table (*.act);;RIFF palette (*.pal)"));
+        if (path.isEmpty()) return;
+        tdoc(exp_filepath)->setPlainText(path);
+    }
+
+    // known palette formats by suffix, anything else gets the text format above
+    bool known, ok = write_palette_file(path, the_pal, the_pal_c, &known);
+    if (!known) {
+        QFile f(path);
+        ok = f.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)
+            && f.write(export_s().toUtf8()) >= 0;
+    }
+
+    if (ok) {
+        statusBar()->showMessage(tr("Wrote %1").arg(QDir::toNativeSeparators(path)), 3000);
+    } else {
+        QMessageBox::information(this,
+QGuiApplication::applicationDisplayName(),
+tr("Cannot write %1").arg(QDir::toNativeSeparators(path)));
+    }
 }
 
 void MainWin::exp_preset(int p)
@@ -422,36 +540,178 @@ void MainWin::genGray()
     preview();
 }
 
-static auto get_kmeans_data(QImage const &src)
+// k-means and refinement run on bg, applyGenerated takes the result
+void MainWin::genHist()
 {
-    std::vector<std::array<float,3>> data;
-    int y, x, w=src.width(), h=src.height();
-    for( y=0; y<h; ++y ) {
-        auto s = (int32_t const*) src.scanLine(y);
-        for( x=0; x<w; x++ ) {
-            int32_t rgb = s[x];
-            float
-            b = ( rgb & 0xFF ),
-            g = ( rgb >> 8 & 0xff ),
-            r = ( rgb >> 16 & 0xff );
-            data.push_back({{r,g,b}});
+    if (!ladder.valid() || the_pal_c <= 0) return;
+
+    // selected colors stay put, the rest are fitted around them starting from where they are
+    std::vector<bool> locked = selectedColors();
+    std::vector<uint32_t> cur;
+    if (!locked.empty()) {
+        for( int i=0; i<the_pal_c; ++i ) {
+            cur.push_back(the_pal[i].rgb() & 0xffffff);
+            if (!the_pal[i].alpha()) locked[i] = true; // the transparent entry
         }
     }
-    return data;
+    int n = the_pal_c;
+    gen_job = bg.submit([h = hist, l = ladder, n, cur, locked]() {
+        TRACE_SCOPE("genHist");
+        GenResult r;
+        r.locked = locked;
+        if (locked.empty())
+            r.pal = refine_palette(h.get(), l.get().get(n), coarse_bits);
+        else
+            r.pal = refine_palette(h.get(), kmeans_palette(h.get().reduced(coarse_bits), cur, locked), coarse_bits, locked);
+        return r;
+    }).share();
+    when_ready(gen_job, "applyGenerated");
+    statusBar()->showMessage(tr("Generating palette..."));
+}
+
+void MainWin::applyGenerated()
+{
+    if (!gen_job.valid() || gen_job.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+    statusBar()->clearMessage();
+    auto const &r = gen_job.get();
+    // the palette was resized while this ran. its colors are for another size
+    if (r.pal.empty() || (int) r.pal.size() != the_pal_c) return;
+    for( size_t i=0; i<r.pal.size(); ++i )
+        if (r.locked.empty() || !r.locked[i]) set_color(i, QColor(r.pal[i]));
+    if (r.locked.empty()) generated = r.pal;
+    refreshTable();
+    preview();
 }
 
-void MainWin::genHist()
+void MainWin::showHist()
 {
-    const int n = the_pal_c;
-    auto data = get_kmeans_data(gscaled(img_src,128,80,Qt::IgnoreAspectRatio,1));
-    auto mc = dkm::kmeans_lloyd(data, n);
+    if (!hist_view) {
+        hist_view = new QLabel(this, Qt::Tool);
+        hist_view->setWindowTitle(tr("Histogram"));
+        hist_view->setAlignment(Qt::AlignCenter);
+        hist_view->setMinimumSize(360, 256);
+    }
+    hist_view->show();
+    hist_view->raise();
+    updateHistView();
+}
 
-    for( int i=0; i<n; ++i ) {
-        auto m = std::get<0>(mc)[i];
-        int r = (int) m[2], g = (int) m[1], b = (int) m[0];
-        set_color(i, QColor(r,g,b));
+void MainWin::updateHistView()
+{
+    if (!hist_view || !hist_view->isVisible() || !hist.valid()) return;
+    if (hist.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        hist_view->setText(tr("Counting colors..."));
+        return;
     }
+    TRACE_SCOPE("render_histogram");
+    hist_view->setPixmap(QPixmap::fromImage(render_histogram(hist.get(), 360, 256)));
+}
+
+// results side by side, scaled to cells, with their figures under each
+static QImage compare_grid(std::vector<MethodResult> const &res, int cw, int ch)
+{
+    const int cols = 3, text = 34;
+    const int rows = ( res.size() + cols - 1 ) / cols;
+    QImage grid(cols * cw, rows * ( ch + text ), QImage::Format_RGB32);
+    grid.fill(Qt::darkGray);
+    QPainter p(&grid);
+    ScaleBuffers buf;
+    for( size_t i=0; i<res.size(); ++i ) {
+        int x = i % cols * cw, y = i / cols * ( ch + text );
+        expand_indexed(res[i].img, buf.rgb);
+        QImage s = gscaled(buf.rgb, cw, ch, Qt::KeepAspectRatio, 1, &buf);
+        p.drawImage(x + ( cw - s.width() ) / 2, y + ( ch - s.height() ) / 2, s);
+        auto const &q = res[i].quality;
+        p.setPen(Qt::white);
+        p.drawText(QRect(x, y + ch, cw, text), Qt::AlignCenter,
+            QString("%1\n%2 ms  PSNR %3  dE %4").arg(qfun_names[i])
+            .arg(res[i].ms, 0, 'f', 1).arg(q.psnr, 0, 'f', 2).arg(q.delta_e, 0, 'f', 2));
+    }
+    return grid;
+}
 
-    refreshTable();
-    preview();
+void MainWin::compareAll()
+{
+    if (img_src.isNull()) return;
+    if (!compare_view) {
+        compare_view = new QLabel(this, Qt::Tool);
+        compare_view->setWindowTitle(tr("Dither methods"));
+        compare_view->setAlignment(Qt::AlignCenter);
+    }
+    // quantizeAll waits on 'workers' like the tuner, so it runs on bg as well
+    QuantizerContext ctx = job_context();
+    QImage src = img_src;
+    compared = bg.submit([this, ctx, src]() {
+        TRACE_SCOPE("compareAll");
+        return quantizeAll(workers, ctx, src);
+    }).share();
+    when_ready(compared, "updateCompareView");
+    compare_view->setText(tr("Comparing..."));
+    compare_view->show();
+    compare_view->raise();
+}
+
+void MainWin::updateCompareView()
+{
+    if (!compare_view || !compared.valid()) return;
+    if (compared.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+    compare_view->setPixmap(QPixmap::fromImage(compare_grid(compared.get(), 320, 240)));
+}
+
+void MainWin::tuneDither()
+{
+    if (img_src.isNull()) return;
+    if (!tune_view) {
+        tune_view = new QListWidget(this);
+        tune_view->setWindowFlags(Qt::Tool);
+        tune_view->setWindowTitle(tr("Tuned dither settings"));
+        tune_view->setMinimumSize(420, 240);
+        connect(tune_view, &QListWidget::currentRowChanged, this, &MainWin::applyTune);
+    }
+    // the tuner waits on 'workers', so it runs on bg rather than in that pool
+    QImage src = img_src;
+    tuned = bg.submit([this, src]() { return tune_dither(workers, src); }).share();
+    when_ready(tuned, "updateTuneView");
+    tune_view->show();
+    tune_view->raise();
+    updateTuneView();
+}
+
+void MainWin::updateTuneView()
+{
+    if (!tune_view || !tuned.valid()) return;
+    QSignalBlocker block(tune_view);
+    tune_view->clear();
+    if (tuned.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        tune_view->addItem(tr("Searching..."));
+        return;
+    }
+    for( auto const &r : tuned.get() )
+        tune_view->addItem(tr("%1 colors, %2, error %3 %4: dE %5, %6 bytes")
+            .arg(r.pal.size()).arg(qfun_names[r.mode])
+            .arg(QString::number(r.err_fract * 100 / 1024) + '%')
+            .arg(r.pingpong ? tr("pingpong") : QString())
+            .arg(r.delta_e, 0, 'f', 2).arg(r.bytes));
+}
+
+// takes over palette and settings of a tuner result
+void MainWin::applyTune(int row)
+{
+    if (!tuned.valid() || tuned.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return;
+    auto const &res = tuned.get();
+    if (row < 0 || row >= (int) res.size()) return;
+    auto const &r = res[row];
+    {
+        QSignalBlocker b0(ui->dit_mode), b1(ui->dit_pp), b2(ui->dit_ed_fract), b3(ui->dit_ed_fract2);
+        ui->dit_mode->setCurrentIndex(r.mode);
+        ui->dit_pp->setChecked(r.pingpong);
+        ui->dit_ed_fract->setValue(r.err_fract);
+        ui->dit_ed_fract2->setValue(r.err_fract);
+    }
+    dither_method = r.mode;
+    qctx.pingpong = r.pingpong;
+    qctx.err_fract = r.err_fract;
+    for( size_t i=0; i<r.pal.size(); ++i )
+        set_color(i, QColor(r.pal[i]));
+    setColorCount(r.pal.size()); // refreshes the table and the preview
 }
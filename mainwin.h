@@ -4,12 +4,17 @@
 #include <QMainWindow>
 #include <QImage>
 #include <QTableWidgetItem>
+#include <QTimer>
+#include <QElapsedTimer>
+#include "quantize.h"
+#include "histogram.h"
+#include "bufpool.h"
+#include "tuner.h"
 
 extern int the_pal_c;
 
-extern int
-ed_err_fract,// 10 fractional bits. used to limit dither error distribution
-ed_pingpong_enable;// alternate diffusion direction each scanline
+class QLabel;
+class QListWidget;
 
 namespace Ui {
 class MainWin;
@@ -31,12 +36,13 @@ protected:
 public slots:
     bool load_src(const QString &);
     void open();
+    void saveOutput();
 
     // visual feedback image
     void scaleSrc();
     void preview();
     void setDitherMethod(int x) { dither_method=x; preview(); }
-    void setDitherPP(int x) { ed_pingpong_enable=x; preview(); }
+    void setDitherPP(int x) { qctx.pingpong=x; preview(); }
     void setDitherE(int x);
     void resetDitherE();
     void setColorCount(int x);
@@ -44,13 +50,25 @@ public slots:
     // palette edits
     QColor sample();
     void addColor();
+    void addTransparent();
     void delColors();
     void setColor();
     void colorEditMode(bool);
     void refreshTable();
     void sortColors();
+    void sortByLuma();
+    void sortHilbert();
+    void compactOrder();
     void genGray();
     void genHist();
+    void applyGenerated();
+    void showHist();
+    void updateHistView();
+    void compareAll();
+    void updateCompareView();
+    void tuneDither();
+    void updateTuneView();
+    void applyTune(int);
 
     // export functions
     void exp_preview();
@@ -61,10 +79,51 @@ public slots:
 
 private:
     Ui::MainWin *ui;
+    BufferPool pool; // quantizer scratch and output. before anything that may hold its buffers
+    BufferPool job_pool; // the same for full resolution jobs, so they don't count against the preview
     QImage img_src;
+    QImage view_src; // img_src as shown in srv_view, for dithering in screen space
+    QImage view_out; // as shown in out_view. sample() reads these instead of grabbing the window
+    ScaleBuffers src_buf, out_buf; // per view, reused while the view size stays the same
+    QuantizerContext qctx; // dither settings. the palette is copied from the_pal on use
+    unsigned pal_rev = 0;
+    int pal_c = -1; // the_pal_rev and the_pal_c that qctx.pal was built from
+    QuantizerContext const &context();
+    QuantizerContext job_context(); // context() with job_pool
     QColor sampled_color;
+    QTimer sample_timer; // mouse moves are sampled at most once per display frame
+    QElapsedTimer since_sample;
+    void sampleMove();
     int dither_method;
     bool live_edit_on;
+    std::shared_future<Histogram> hist; // of the full resolution source
+    std::shared_future<PaletteLadder> ladder; // from hist at coarse_bits
+    std::vector<uint32_t> generated; // the palette genHist or the ladder set last
+    struct GenResult {
+        std::vector<uint32_t> pal;
+        std::vector<bool> locked; // entries of pal that are not to be set
+    };
+    std::shared_future<GenResult> gen_job; // the last genHist
+    bool fromLadder(int n);
+    std::vector<bool> selectedColors();
+    void sortBy(int key);
+    QLabel *hist_view = nullptr;
+    QLabel *compare_view = nullptr;
+    std::shared_future<std::vector<MethodResult>> compared;
+    std::shared_future<std::vector<TuneResult>> tuned;
+    QListWidget *tune_view = nullptr;
+    ThreadPool workers; // compareAll, tuneDither
+    ThreadPool bg{1}; // background jobs. last, so it is drained first
+
+    // runs slot on the GUI thread once f is ready. the wait takes bg's only
+    // thread, so the job that makes f must be queued on bg before this
+    template<typename T> void when_ready(std::shared_future<T> f, const char *slot)
+    {
+        bg.submit([this, f, slot]() {
+            f.wait();
+            QMetaObject::invokeMethod(this, slot, Qt::QueuedConnection);
+        });
+    }
 
 protected:
     void keyPressEvent(QKeyEvent *);
@@ -10,18 +10,52 @@ QMAKE_CXXFLAGS += -std=c++14 -O3 -g -Wno-parentheses -ffast-math -march=native -
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
+# stage timers in the status bar, qmake CONFIG+=trace
+CONFIG(trace): DEFINES += MANPAL_TRACE
+
 TARGET = manpal
 TEMPLATE = app
 
 SOURCES += main.cpp\
         mainwin.cpp \
-    palettem.cpp
+    palettem.cpp \
+    palette.cpp \
+    palbundle.cpp \
+    histogram.cpp \
+    quantize.cpp \
+    quality.cpp \
+    cli.cpp \
+    tuner.cpp \
+    gifwriter.cpp \
+    palfile.cpp \
+    palorder.cpp \
+    trace.cpp
+
+# quantization service, Unix domain sockets and POSIX shared memory
+unix: SOURCES += daemon.cpp
+linux: LIBS += -lrt
 
 HEADERS  += mainwin.h \
     palettem.h \
+    palette.h \
+    palbundle.h \
+    srgb_tables.inc \
+    histogram.h \
+    threadpool.h \
     vec3.h \
     dithered.h \
+    bufpool.h \
     imgfilter.h \
+    pipeline.h \
+    riemersma.h \
+    scq.h \
+    quantize.h \
+    quality.h \
+    tuner.h \
+    gifwriter.h \
+    palfile.h \
+    palorder.h \
+    trace.h \
     dkm_utils.hpp \
     dkm.hpp
 
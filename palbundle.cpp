@@ -0,0 +1,88 @@
+#include <cstring>
+#include <type_traits>
+#include "palbundle.h"
+
+static_assert(std::is_trivially_copyable<Palette>::value, "Palette must stay copyable byte for byte");
+
+namespace {
+// entries follow the header, aligned for the SSE members
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size; // changes with the Palette layout
+    uint32_t endian; // 0x01020304 as written
+    uint32_t count;
+    uint8_t pad[40];
+};
+}
+
+static const char magic[8] = {'M','P','A','L','B','N','D','L'};
+static const uint32_t version = 1;
+
+static_assert(sizeof(Header) % alignof(PaletteBundle::Entry) == 0, "entries would be misaligned");
+
+bool PaletteBundle::open(QString const &path)
+{
+    close();
+    f.setFileName(path);
+    if (!f.open(QIODevice::ReadOnly)) return false;
+    qint64 size = f.size();
+    if (size < (qint64) sizeof(Header)) {
+        close();
+        return false;
+    }
+    uchar *p = f.map(0, size);
+    if (!p) {
+        close();
+        return false;
+    }
+    Header const *h = (Header const*) p;
+    bool ok = !memcmp(h->magic, magic, sizeof magic) && h->version == version
+        && h->entry_size == sizeof(Entry) && h->endian == 0x01020304
+        && size >= (qint64) ( sizeof(Header) + (qint64) h->count * sizeof(Entry) );
+    if (!ok) {
+        close();
+        return false;
+    }
+    entries = (Entry const*) ( p + sizeof(Header) );
+    count = h->count;
+    return true;
+}
+
+void PaletteBundle::close()
+{
+    f.close(); // unmaps
+    entries = nullptr;
+    count = 0;
+}
+
+int PaletteBundle::find(QString const &name) const
+{
+    QByteArray n = name.toUtf8();
+    for( int i=0; i<count; ++i )
+        if (n == entries[i].name) return i;
+    return -1;
+}
+
+bool PaletteBundle::write(QString const &path, std::vector<QString> const &names, std::vector<Palette> const &pals)
+{
+    QFile out(path);
+    if (names.size() != pals.size() || !out.open(QIODevice::WriteOnly)) return false;
+    Header h;
+    memset(&h, 0, sizeof h);
+    memcpy(h.magic, magic, sizeof magic);
+    h.version = version;
+    h.entry_size = sizeof(Entry);
+    h.endian = 0x01020304;
+    h.count = pals.size();
+    bool ok = out.write((const char*) &h, sizeof h) == sizeof h;
+    for( size_t i=0; i<pals.size() && ok; ++i ) {
+        Entry e;
+        memset(e.name, 0, sizeof e.name);
+        QByteArray n = names[i].toUtf8().left(sizeof e.name - 1);
+        memcpy(e.name, n.constData(), n.size());
+        e.pal = pals[i];
+        ok = out.write((const char*) &e, sizeof e) == sizeof e;
+    }
+    return ok;
+}
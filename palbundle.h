@@ -0,0 +1,48 @@
+#ifndef PALBUNDLE_H
+#define PALBUNDLE_H
+#include <vector>
+#include <QFile>
+#include <QString>
+#include "palette.h"
+
+/*
+ * Palette bundle: prebuilt Palette objects in one file, loaded with mmap.
+ *
+ * A Palette holds its sRGB, linear and premultiplied colors, the line
+ * search order and the gray lookup table, and no pointers. The bundle
+ * stores them byte for byte, so opening one is mapping the file and
+ * checking the header. Nothing is converted or rebuilt, and processes
+ * that open the same bundle share its pages.
+ *
+ * The layout is that of the build that wrote the file. A bundle from a
+ * build with a different Palette is rejected, write it again.
+ */
+class PaletteBundle {
+public:
+    struct Entry {
+        char name[64]; // nul terminated
+        Palette pal;
+    };
+
+    PaletteBundle() {}
+    explicit PaletteBundle(QString const &path) { open(path); }
+    PaletteBundle(PaletteBundle const&) = delete;
+
+    bool open(QString const &path); // false if missing, truncated or from another build
+    void close();
+    bool isOpen() const { return entries != nullptr; }
+
+    int size() const { return count; }
+    Palette const &operator[](int i) const { return entries[i].pal; }
+    const char *name(int i) const { return entries[i].name; }
+    int find(QString const &name) const; // -1 if not there
+
+    static bool write(QString const &path, std::vector<QString> const &names, std::vector<Palette> const &pals);
+
+private:
+    QFile f;
+    Entry const *entries = nullptr;
+    int count = 0;
+};
+
+#endif // PALBUNDLE_H
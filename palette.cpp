@@ -0,0 +1,165 @@
+#include <cmath>
+#include <climits>
+#include "palette.h"
+
+float sRGBtoLf(float c) {
+    return c > 0.04045f ? powf((c+0.055f)*(1./1.055f),2.4f) : c/12.92f;
+}
+float LtosRGBf(float c) {
+    return c > .0031308f ? 1.055f*powf(c,1/2.4f) - 0.055 : c*12.92f;
+}
+
+#if 1
+int sRGBtoL(int c) { return sRGBtoL_table[c & 0x7fff]; }
+int LtosRGB(int c) { return LtosRGB_table[c & 0x7fff]; }
+#else
+int sRGBtoL(int c) { return sRGBtoLf((1./0x7fff)*c)*0x7fff; }
+int LtosRGB(int c) { return LtosRGBf((1./0x7fff)*c)*0x7fff; }
+#endif
+
+// precomputed by gentables.cpp. read only data, nothing to initialize at startup
+int const sRGBtoL_table[0x8000] = {
+#define SRGB_TO_L
+#include "srgb_tables.inc"
+#undef SRGB_TO_L
+};
+int const LtosRGB_table[0x8000] = {
+#define L_TO_SRGB
+#include "srgb_tables.inc"
+#undef L_TO_SRGB
+};
+
+Palette::Palette(uint32_t const *colors, int count, bool with_alpha)
+{
+    n = count < 0 ? 0 : ( count > 256 ? 256 : count );
+    for( int i=0; i<n; ++i ) {
+        uint32_t c = rgb[i] = colors[i] & 0xffffff;
+        float r = (c >> 16) / 255.f, g = (c >> 8 & 0xff) / 255.f, b = (c & 0xff) / 255.f;
+        lin[i] = ivec3(sRGBtoLf(r)*0x7fff, sRGBtoLf(g)*0x7fff, sRGBtoLf(b)*0x7fff);
+        alpha[i] = with_alpha ? colors[i] >> 24 : 255;
+        pre[i] = premultiply(lin[i], alpha[i] * 0x7fff / 255);
+        has_alpha = has_alpha || alpha[i] != 255;
+        if (alpha[i] == 0 && transparent < 0) transparent = i;
+    }
+    find_line();
+
+    gray = n > 0;
+    for( int i=0; i<n; ++i )
+        gray = gray && (rgb[i] >> 16) == (rgb[i] & 0xff) && (rgb[i] >> 8 & 0xff) == (rgb[i] & 0xff);
+    if (gray) {
+        for( int v=0; v<0x8000; ++v )
+            gray_lut[v] = map(ivec3(v));
+    }
+}
+
+int Palette::map(ivec4 ref) const
+{
+    long R=LONG_MAX;
+    int Ri=0;
+    for(int i=0; i<n; ++i) {
+        long r = (pre[i] - ref).lensq<long>();
+        if ( r < R ) {
+            Ri = i;
+            R = r;
+        }
+    }
+    return Ri;
+}
+
+static double dot(ivec3 a, ivec3 b)
+{
+    return (double) a.s[0]*b.s[0] + (double) a.s[1]*b.s[1] + (double) a.s[2]*b.s[2];
+}
+
+void Palette::find_line()
+{
+    line = false;
+    if (n < 32) return; // the full search is fast enough
+
+    // direction from the first entry to the one furthest from it
+    line_o = lin[0];
+    line_d2 = 0;
+    for( int i=1; i<n; ++i ) {
+        ivec3 d = lin[i] - line_o;
+        if (dot(d, d) > line_d2) {
+            line_d = d;
+            line_d2 = dot(d, d);
+        }
+    }
+    if (line_d2 == 0) return;
+
+    // worth it when the palette is much longer than it is wide
+    double lo = 0, hi = 0, perp2 = 0;
+    for( int i=0; i<n; ++i ) {
+        ivec3 v = lin[i] - line_o;
+        double t = dot(v, line_d);
+        lo = std::min(lo, t);
+        hi = std::max(hi, t);
+        perp2 = std::max(perp2, dot(v, v) - t * t / line_d2);
+    }
+    double span2 = (hi - lo) * (hi - lo) / line_d2;
+    if (perp2 * 64*64 > span2) return;
+    line_w = std::sqrt(std::max(perp2, 0.));
+
+    for( int i=0; i<n; ++i )
+        order[i] = i;
+    std::stable_sort(order, order + n, [this](int a, int b) {
+        return dot(lin[a] - line_o, line_d) < dot(lin[b] - line_o, line_d);
+    });
+    for( int i=0; i<n; ++i )
+        proj[i] = dot(lin[order[i]] - line_o, line_d);
+    line = true;
+}
+
+int Palette::map_line(ivec3 ref) const
+{
+    ivec3 v = ref - line_o;
+    double q = dot(v, line_d);
+    double off = std::sqrt(std::max(dot(v, v) - q * q / line_d2, 0.)) - line_w;
+    double off2 = off > 0 ? off * off : 0;
+    int hi = std::lower_bound(proj, proj + n, q) - proj;
+    int lo = hi - 1;
+    long R = LONG_MAX;
+    int Ri = 0;
+
+    // (proj - q)^2 / line_d2 + off2 is a lower bound of the distance.
+    // distances are integers, so anything above R + 0.5 is further than
+    // R even with some rounding error
+    auto beyond = [&](int k) {
+        double t = proj[k] - q;
+        return t * t / line_d2 + off2 > R + 0.5;
+    };
+    auto test = [&](int k) {
+        int i = order[k];
+        long r = (lin[i] - ref).lensq<long>();
+        if ( r < R || ( r == R && i < Ri ) ) {
+            Ri = i;
+            R = r;
+        }
+    };
+    while (lo >= 0 || hi < n) {
+        if (lo >= 0) {
+            if (beyond(lo)) lo = -1;
+            else test(lo--);
+        }
+        if (hi < n) {
+            if (beyond(hi)) hi = n;
+            else test(hi++);
+        }
+    }
+    return Ri;
+}
+
+int Palette::map_full(ivec3 ref) const
+{
+    long R=LONG_MAX;
+    int Ri=0;
+    for(int i=0; i<n; ++i) {
+        long r = (lin[i] - ref).lensq<long>();
+        if ( r < R ) {
+            Ri = i;
+            R = r;
+        }
+    }
+    return Ri;
+}
@@ -0,0 +1,89 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "vec3.h"
+
+// slow but accurate
+float sRGBtoLf(float c);
+float LtosRGBf(float c);
+
+// 15 bits in and out. tables are compiled in, see gentables.cpp
+extern int const sRGBtoL_table[0x8000];
+extern int const LtosRGB_table[0x8000];
+int sRGBtoL(int c);
+int LtosRGB(int c);
+
+// linear color times alpha, alpha in the 4th lane. a is 15 bits
+inline ivec4 premultiply(ivec3 c, int a)
+{
+    if (a == 0x7fff) return ivec4(c.s[0], c.s[1], c.s[2], a); // exact for opaque colors
+    return ivec4(c.s[0] * a >> 15, c.s[1] * a >> 15, c.s[2] * a >> 15, a);
+}
+
+/*
+ * A palette together with everything needed to search it.
+ * Not modified after construction, so any number of quantizers on any
+ * number of threads can share one.
+ * Holds no pointers, so it can be copied byte for byte, see palbundle.h
+ */
+class Palette {
+public:
+    int n = 0;
+    uint32_t rgb[256]; // 0xRRGGBB, sRGB
+    ivec3 lin[256]; // linear color space, 15 bits
+    uint8_t alpha[256]; // 255 is opaque
+    ivec4 pre[256]; // premultiplied linear color and alpha
+    bool gray = false; // every entry has r == g == b
+    bool has_alpha = false; // some entry is not opaque
+    int transparent = -1; // first fully transparent entry, if any
+
+    Palette() {}
+    // colors are 0xAARRGGBB when with_alpha is set, otherwise 0xRRGGBB and opaque
+    Palette(uint32_t const *colors, int count, bool with_alpha=false);
+
+    // index of the nearest color. the lowest index wins a tie
+    int map(ivec3 ref) const { return line ? map_line(ref) : map_full(ref); }
+
+    // same for premultiplied RGBA, compared in all four channels
+    int map(ivec4 ref) const;
+
+    // gray palettes only. same as map(ivec3(v))
+    int map_gray(int v) const { return gray_lut[std::min(std::max(v, 0), 0x7fff)]; }
+
+private:
+    /*
+     * Palettes on or near a line (gray ramps, duotones) are sorted by
+     * their projection on it and searched outwards from the projection of
+     * the color. The distance along the line plus how far the color is off
+     * the line gives a lower bound of the real distance, so the search
+     * stops as soon as it can't find anything closer and the result is the
+     * same as with the full search.
+     */
+    bool line = false;
+    ivec3 line_o, line_d; // origin and direction
+    double line_d2; // |line_d|^2
+    double line_w; // largest distance of an entry from the line
+    uint8_t order[256]; // entries sorted by projection
+    double proj[256]; // sorted dot products with line_d
+    uint8_t gray_lut[0x8000]; // nearest color of every gray level. gray palettes only
+
+    int map_full(ivec3 ref) const;
+    int map_line(ivec3 ref) const;
+    void find_line();
+};
+
+class BufferPool;
+
+/*
+ * Everything a quantizer reads. Pass one to quantizeImg/quantizeStream
+ */
+struct QuantizerContext {
+    Palette pal;
+    int err_fract = 1024; // 10 fractional bits. used to limit dither error distribution
+    int pingpong = 0; // alternate diffusion direction every 15 scanlines
+    BufferPool *pool = nullptr; // optional. scratch and output buffers are recycled through it
+};
+
+#endif // PALETTE_H
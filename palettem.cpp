@@ -1,23 +1,23 @@
 #include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <limits>
 #include <cstdlib>
 #include <vector>
+#include <algorithm>
 #include <QBrush>
 #include <QColor>
 #include "palettem.h"
 #include "vec3.h"
 
-int sRGBtoL_table[0x8000];
-int LtosRGB_table[0x8000];
-
 QColor the_pal[257];
-ivec3 the_pal_iv[257];
 int the_pal_c = 0;
+unsigned the_pal_rev = 0;
 
 void set_color(int i, QColor c)
 {
     the_pal[i] = c;
-    the_pal_iv[i] = qcolor_to_ivec3_s(c);
+    ++the_pal_rev;
 }
 
 int add_color(QColor c)
@@ -33,71 +33,80 @@ void del_color(int x0)
     while ( x0 < 255 ) {
         int x = x0 + 1;
         the_pal[x0] = the_pal[x];
-        the_pal_iv[x0] = the_pal_iv[x0];
         x0 = x;
     }
+    ++the_pal_rev;
 }
 
-int map_palette(ivec3 ref)
+Palette palette_from(QColor const pal[], int n)
 {
-    long R=LONG_MAX;
-    int Ri=0;
-    for(int i=0; i<the_pal_c; ++i) {
-        long r = (the_pal_iv[i] - ref).lensq<long>();
-        if ( r < R ) {
-            Ri = i;
-            R = r;
-        }
-    }
-    return Ri;
+    uint32_t argb[256];
+    n = n < 0 ? 0 : ( n > 256 ? 256 : n );
+    for( int i=0; i<n; ++i )
+        argb[i] = pal[i].rgba();
+    return Palette(argb, n, true);
 }
 
-static int ccmp(const void* A, const void*B)
+// position along a Hilbert curve through the RGB cube, Skilling's method.
+// colors close on the curve are close in the cube
+static uint32_t hilbert_rgb(int r, int g, int b)
 {
-    auto a = (const QColor *) A;
-    auto b = (const QColor *) B;
-    int h0 = a->hue(), h1 = b->hue();
-    int v0 = a->lightness(), v1 = b->lightness();
-    if (h0 < h1) return -1;
-    if (h0 > h1) return 1;
-    if (v0 < v1) return -1;
-    if (v0 > v1) return 1;
-    return 0;
+    int X[3] = {r, g, b};
+    for( int q=0x80; q>1; q>>=1 ) {
+        int p = q - 1;
+        for( int i=0; i<3; ++i ) {
+            if (X[i] & q) X[0] ^= p;
+            else {
+                int t = ( X[0] ^ X[i] ) & p;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+    for( int i=1; i<3; ++i ) X[i] ^= X[i-1];
+    int t = 0;
+    for( int q=0x80; q>1; q>>=1 )
+        if (X[2] & q) t ^= q - 1;
+    uint32_t h = 0;
+    for( int bit=7; bit>=0; --bit )
+        for( int i=0; i<3; ++i )
+            h = h << 1 | ( ( X[i] ^ t ) >> bit & 1 );
+    return h;
 }
 
-void sort_palette()
+static uint32_t sort_key(QColor const &c, int key)
 {
-    qsort(the_pal, the_pal_c, sizeof(the_pal[0]), ccmp);
-    for( int i=0; i<the_pal_c; ++i )
-        the_pal_iv[i] = qcolor_to_ivec3_s(the_pal[i]);
-}
-
-float sRGBtoLf(float c) {
-    return c > 0.04045f ? powf((c+0.055f)*(1./1.055f),2.4f) : c/12.92f;
-}
-float LtosRGBf(float c) {
-    return c > .0031308f ? 1.055f*powf(c,1/2.4f) - 0.055 : c*12.92f;
+    switch (key) {
+    case SORT_LUMA:
+        return 299 * c.red() + 587 * c.green() + 114 * c.blue();
+    case SORT_HILBERT:
+        return hilbert_rgb(c.red(), c.green(), c.blue());
+    default:
+        return ( c.hue() + 1 ) << 8 | c.lightness(); // grays first
+    }
 }
 
-#if 1
-int sRGBtoL(int c) { return sRGBtoL_table[c & 0x7fff]; }
-int LtosRGB(int c) { return LtosRGB_table[c & 0x7fff]; }
-#else
-int sRGBtoL(int c) { return sRGBtoLf((1./0x7fff)*c)*0x7fff; }
-int LtosRGB(int c) { return LtosRGBf((1./0x7fff)*c)*0x7fff; }
-#endif
-
-
-void make_tables()
+std::vector<int> sort_palette(int key, std::vector<bool> const &sel)
 {
-    const int k = 0x8000;
-    const float df = 1.0f / k;
-    float f = 0;
-    for( int i=0; i<k; ++i ) {
-        LtosRGB_table[i] = LtosRGBf( f ) * k;
-        sRGBtoL_table[i] = sRGBtoLf( f ) * k;
-        f += df;
+    std::vector<int> order(the_pal_c), slots;
+    for( int i=0; i<the_pal_c; ++i ) {
+        order[i] = i;
+        if (sel.empty() || ( i < (int) sel.size() && sel[i] )) slots.push_back(i);
     }
+    // keys once, not on every comparison
+    std::vector<uint32_t> k(the_pal_c);
+    for( int i : slots ) k[i] = sort_key(the_pal[i], key);
+    std::vector<int> by = slots;
+    std::stable_sort(by.begin(), by.end(), [&k](int a, int b) { return k[a] < k[b]; });
+
+    QColor old[256];
+    std::copy(the_pal, the_pal + the_pal_c, old);
+    for( size_t j=0; j<slots.size(); ++j ) {
+        order[slots[j]] = by[j];
+        the_pal[slots[j]] = old[by[j]];
+    }
+    ++the_pal_rev;
+    return order;
 }
 
 int PaletteM::getidx(const QModelIndex &i) const
@@ -125,7 +134,7 @@ QVariant PaletteM::data(const QModelIndex &index, int role) const
     switch(role) {
         case Qt::ToolTipRole:
         case Qt::StatusTipRole:
-            return QVariant(c.name());
+            return QVariant(c.name(c.alpha() < 255 ? QColor::HexArgb : QColor::HexRgb));
         case Qt::BackgroundRole:
             br = QBrush(c);
             if (xx) br.setStyle(Qt::Dense3Pattern);
@@ -159,21 +168,6 @@ QModelIndex PaletteM::getLast()
     return index(r,c);
 }
 
-static void getcf(float xf[14], int b[14], QColor c)
-{
-    qreal x[14];
-    c.getRgbF(x, x+1, x+2, x+3);
-    c.getHsvF(x+4, x+5, x+6);
-    c.getHslF(x+7, x+8, x+9);
-    c.getCmykF(x+10, x+11, x+12, x+13);
-
-    for( int i=0; i<14; ++i ) {
-        int val = x[i] * 255;
-        xf[i] = x[i];
-        b[i] = val < 0 ? 0 : ( val > 255 ? 255 : val );
-    }
-}
-
 const QString color_format_help =
 "$(...) for sRGB\n"
 "$[...] for linear RGB\n"
@@ -188,49 +182,115 @@ const QString color_format_help =
 "  x        2-digit hex value in range 00-FF\n"
 "  f        real number in range 0.0-1.0\n";
 
-QString format_color(QColor c0, QString column )
+// color components in the order of the letters below. 4 groups: RGBA HSV HSL CMYK
+static const char comp_letters[] = "rgbahsvHSLcmyk";
+static const int comp_group[14] = {0,0,0,0, 1,1,1, 2,2,2, 3,3,3,3};
+
+ColorFormat::ColorFormat(QString const &t)
+{
+    const int n = t.size();
+    QString lit;
+    groups[0] = groups[1] = 0;
+
+    for( int i=0; i<n; ) {
+        // $(c) $(cx) $(cf) and the same with [] for linear
+        char16_t open = i+1 < n ? t.at(i+1).unicode() : 0;
+        int space = open == '(' ? 0 : ( open == '[' ? 1 : -1 );
+        if (t.at(i).unicode() == '$' && space >= 0 && i+3 < n) {
+            char16_t close = ")]"[space];
+            char16_t l = t.at(i+2).unicode();
+            char16_t f = t.at(i+3).unicode();
+            int fmt = f == 'x' ? 1 : ( f == 'f' ? 2 : 0 );
+            int len = fmt ? 5 : 4;
+            const char *c = l < 128 ? strchr(comp_letters, l) : nullptr;
+            if (c && *c && i+len <= n && t.at(i+len-1).unicode() == close) {
+                if (!lit.isEmpty()) {
+                    prog.push_back({-1, 0, 0, lit});
+                    lit.clear();
+                }
+                int comp = c - comp_letters;
+                prog.push_back({space, comp, fmt, QString()});
+                groups[space] |= 1 << comp_group[comp];
+                i += len;
+                continue;
+            }
+        }
+        lit.append(t.at(i++));
+    }
+    if (!lit.isEmpty())
+        prog.push_back({-1, 0, 0, lit});
+}
+
+// fill in the component groups selected by mask
+static void getcf(float x[14], int mask, QColor const &c)
+{
+    qreal v[4] = {0,0,0,0};
+    if (mask & 1) {
+        c.getRgbF(v, v+1, v+2, v+3);
+        for( int i=0; i<4; ++i ) x[i] = v[i];
+    }
+    if (mask & 2) {
+        c.getHsvF(v, v+1, v+2);
+        for( int i=0; i<3; ++i ) x[4+i] = v[i];
+    }
+    if (mask & 4) {
+        c.getHslF(v, v+1, v+2);
+        for( int i=0; i<3; ++i ) x[7+i] = v[i];
+    }
+    if (mask & 8) {
+        c.getCmykF(v, v+1, v+2, v+3);
+        for( int i=0; i<4; ++i ) x[10+i] = v[i];
+    }
+}
+
+void ColorFormat::append(QString &out, QColor c0) const
 {
     // c0 in sRGB color space
     // c1 is linear
-    const QColor
-    c1 = QColor(sRGBtoLf(c0.redF()), sRGBtoLf(c0.greenF()), sRGBtoLf(c0.blueF()));
-
-    const int nc = 14;
-    const char xc[] = "rgbahsvHSLcmyk";
-    float xf[2][nc];
-    int xb[2][nc];
-
-    getcf( xf[0], xb[0], c0 );
-    getcf( xf[1], xb[1], c1 );
-
-    for( int k=0; k<2; ++k ) {
-        for( int j=0; j<nc; ++j ) {
-            float f = xf[k][j];
-            int B = xb[k][j];
-            char l = "(["[k], r = ")]"[k], c = xc[j];
-            char val[3][32], pat[3][32];
-
-            sprintf(val[0], "%d", B);
-            sprintf(val[1], "%02x", B);
-            sprintf(val[2], "%.5f", f);
-
-            sprintf(pat[0], "$%c%c%c", l, c, r);
-            sprintf(pat[1], "$%c%cx%c", l, c, r);
-            sprintf(pat[2], "$%c%cf%c", l, c, r);
-
-            for( int m=0; m<3; ++m )
-                column = column.replace(pat[m], val[m]);
+    float x[2][14];
+    if (groups[0]) getcf(x[0], groups[0], c0);
+    if (groups[1]) {
+        QColor c1 = QColor::fromRgbF(sRGBtoLf(c0.redF()), sRGBtoLf(c0.greenF()), sRGBtoLf(c0.blueF()));
+        getcf(x[1], groups[1], c1);
+    }
+
+    for( auto const &t : prog ) {
+        if (t.space < 0) {
+            out.append(t.text);
+            continue;
+        }
+        float f = x[t.space][t.comp];
+        int val = f * 255;
+        int B = val < 0 ? 0 : ( val > 255 ? 255 : val );
+        char buf[32];
+        switch(t.fmt) {
+            case 0: snprintf(buf, sizeof buf, "%d", B); break;
+            case 1: snprintf(buf, sizeof buf, "%02x", B); break;
+            default: snprintf(buf, sizeof buf, "%.5f", f); break;
         }
+        out.append(QLatin1String(buf));
     }
-    return column;
+}
+
+QString ColorFormat::operator()(QColor c) const
+{
+    QString s;
+    append(s, c);
+    return s;
+}
+
+QString format_color(QColor c0, QString column)
+{
+    return ColorFormat(column)(c0);
 }
 
 QString format_pal(QString s, QString const &end, QString const & color_fmt, QColor const pal[], int count)
 {
+    const ColorFormat fmt(color_fmt);
     auto nl = QChar::LineFeed;
     s.append(nl);
     for(int i=0; i<count; ++i) {
-        s.append(format_color(pal[i], color_fmt));
+        fmt.append(s, pal[i]);
         s.append(nl);
     }
     s.append(end);
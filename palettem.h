@@ -1,31 +1,31 @@
 #ifndef PALETTEM_H
 #define PALETTEM_H
+#include <vector>
 #include <QObject>
+#include <QColor>
+#include <QString>
 #include <QModelIndex>
 #include <QAbstractItemModel>
 #include <QAbstractTableModel>
 #include "vec3.h"
+#include "palette.h"
 
-// last color is never used
-extern ivec3 the_pal_iv[257]; // linear color space
+// the palette being edited. last color is never used
 extern QColor the_pal[257]; // qt color space (nonlinear?)
 extern int the_pal_c;
+extern unsigned the_pal_rev; // counts edits of the_pal, so snapshots know when to rebuild
 
 void set_color(int i, QColor c);
 int add_color(QColor c);
 void del_color(int i);
-int map_palette(ivec3);
-void sort_palette();
 
-// slow but accurate
-float sRGBtoLf(float c);
-float LtosRGBf(float c);
+enum SortKey { SORT_HUE, SORT_LUMA, SORT_HILBERT };
+// sorts the entries where sel[i] is set among their own slots, all of them when
+// sel is empty. returns the old index of each entry
+std::vector<int> sort_palette(int key=SORT_HUE, std::vector<bool> const &sel={});
 
-extern int sRGBtoL_table[0x8000];
-extern int LtosRGB_table[0x8000];
-int sRGBtoL(int c);
-int LtosRGB(int c);
-void make_tables(); // initialize tables used above
+// snapshot for the quantizers
+Palette palette_from(QColor const pal[], int n);
 
 class PaletteM : public QAbstractTableModel
 {
@@ -51,6 +51,24 @@ public:
 };
 
 extern const QString color_format_help;
+
+// color format template parsed once, then applied to any number of colors
+class ColorFormat {
+    struct Token {
+        int space; // 0 sRGB, 1 linear, -1 literal text
+        int comp; // index into "rgbahsvHSLcmyk"
+        int fmt; // 0 integer, 1 hex, 2 float
+        QString text;
+    };
+    std::vector<Token> prog;
+    int groups[2]; // component groups each color space needs
+
+public:
+    explicit ColorFormat(QString const &tmpl);
+    void append(QString &out, QColor c) const;
+    QString operator()(QColor c) const;
+};
+
 QString format_color(QColor c0, QString column );
 QString format_pal(QString s, QString const &end, QString const & color_fmt, QColor const pal[], int n_colors);
 
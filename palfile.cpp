@@ -0,0 +1,90 @@
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QByteArray>
+#include "palfile.h"
+
+static bool write_all(QString const &path, QByteArray const &data)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    return f.write(data) == data.size();
+}
+
+bool write_gpl(QString const &path, QColor const pal[], int n)
+{
+    QByteArray s("GIMP Palette\nName: manpal\nColumns: 8\n#\n");
+    char buf[64];
+    for( int i=0; i<n; ++i ) {
+        QColor c = pal[i];
+        snprintf(buf, sizeof buf, "%3d %3d %3d\t%s\n",
+            c.red(), c.green(), c.blue(), c.name().toLatin1().constData());
+        s.append(buf);
+    }
+    return write_all(path, s);
+}
+
+bool write_png_strip(QString const &path, QColor const pal[], int n)
+{
+    // unused cells repeat the last color so no new colors show up
+    QImage img(16, 16, QImage::Format_RGB32);
+    for( int i=0; i<256; ++i ) {
+        QRgb c = n > 0 ? pal[i < n ? i : n-1].rgb() : qRgb(0,0,0);
+        img.setPixel(i & 15, i >> 4, c);
+    }
+    return img.save(path, "PNG");
+}
+
+bool write_act(QString const &path, QColor const pal[], int n)
+{
+    // 256 RGB triplets, then big endian color count and transparent index
+    QByteArray s(772, 0);
+    for( int i=0; i<n && i<256; ++i ) {
+        s[3*i] = pal[i].red();
+        s[3*i+1] = pal[i].green();
+        s[3*i+2] = pal[i].blue();
+    }
+    s[768] = n >> 8;
+    s[769] = n & 0xff;
+    s[770] = s[771] = (char) 0xff; // no transparent color
+    return write_all(path, s);
+}
+
+static void put32(QByteArray &s, uint32_t x)
+{
+    for( int i=0; i<4; ++i ) s.append((char)( x >> 8*i & 0xff ));
+}
+
+bool write_riff_pal(QString const &path, QColor const pal[], int n)
+{
+    QByteArray s;
+    uint32_t data_size = 4 + 4 * n;
+    s.append("RIFF");
+    put32(s, 4 + 8 + data_size);
+    s.append("PAL data");
+    put32(s, data_size);
+    s.append((char) 0); // version 0x0300
+    s.append((char) 3);
+    s.append((char)( n & 0xff ));
+    s.append((char)( n >> 8 ));
+    for( int i=0; i<n; ++i ) {
+        s.append((char) pal[i].red());
+        s.append((char) pal[i].green());
+        s.append((char) pal[i].blue());
+        s.append((char) 0); // flags
+    }
+    return write_all(path, s);
+}
+
+bool write_palette_file(QString const &path, QColor const pal[], int n, bool *known)
+{
+    auto sfx = QFileInfo(path).suffix().toLower();
+    typedef bool (*Writer)(QString const&, QColor const[], int);
+    Writer w = nullptr;
+    if (sfx == "gpl") w = write_gpl;
+    else if (sfx == "png") w = write_png_strip;
+    else if (sfx == "act") w = write_act;
+    else if (sfx == "pal") w = write_riff_pal;
+    if (known) *known = w != nullptr;
+    return w && w(path, pal, n);
+}
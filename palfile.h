@@ -0,0 +1,17 @@
+#ifndef PALFILE_H
+#define PALFILE_H
+#include <QColor>
+#include <QString>
+
+/*
+ * Palette file writers. All take sRGB colors as stored in the_pal
+ */
+bool write_gpl(QString const &path, QColor const pal[], int n); // GIMP palette
+bool write_png_strip(QString const &path, QColor const pal[], int n); // 16x16 image like ffmpeg palettegen
+bool write_act(QString const &path, QColor const pal[], int n); // Adobe color table
+bool write_riff_pal(QString const &path, QColor const pal[], int n); // Microsoft RIFF palette
+
+// pick the writer from the file name suffix. false if the suffix is unknown
+bool write_palette_file(QString const &path, QColor const pal[], int n, bool *known=nullptr);
+
+#endif // PALFILE_H
@@ -0,0 +1,92 @@
+#include <cstdint>
+#include <deque>
+#include <algorithm>
+#include "palorder.h"
+#include "trace.h"
+
+std::vector<int> compact_order(QImage const &img)
+{
+    TRACE_SCOPE("compact_order");
+    const int n = img.colorCount();
+    std::vector<int> order(n);
+    for( int i=0; i<n; ++i ) order[i] = i;
+    if (img.format() != QImage::Format_Indexed8 || n < 3) return order;
+
+    // how often two colors touch, left or above
+    std::vector<uint64_t> adj(256 * 256, 0), freq(256, 0);
+    for( int y=0; y<img.height(); ++y ) {
+        uint8_t const *p = img.constScanLine(y);
+        uint8_t const *up = y ? img.constScanLine(y-1) : nullptr;
+        for( int x=0; x<img.width(); ++x ) {
+            int a = p[x];
+            freq[a]++;
+            if (x && p[x-1] != a) adj[a << 8 | p[x-1]]++;
+            if (up && up[x] != a) adj[a << 8 | up[x]]++;
+        }
+    }
+    auto touch = [&adj](int a, int b) { return adj[a << 8 | b] + adj[b << 8 | a]; };
+
+    std::vector<bool> placed(n, false);
+    int left = 0;
+    for( int i=0; i<n; ++i ) left += freq[i] > 0;
+
+    // grow a chain from the pair that touches most, adding at whichever end
+    // fits best. only the last few entries at each end count, closer ones more
+    std::deque<int> chain;
+    int a0 = -1, b0 = -1;
+    uint64_t best = 0;
+    for( int a=0; a<n; ++a )
+        for( int b=a+1; b<n; ++b )
+            if (touch(a, b) > best) best = touch(a, b), a0 = a, b0 = b;
+    if (a0 < 0) return order; // no edges, a flat image
+    chain = {a0, b0};
+    placed[a0] = placed[b0] = true;
+    left -= 2;
+
+    const int window = 16;
+    while (left > 0) {
+        int pick = -1;
+        bool front = false;
+        double top = -1;
+        for( int c=0; c<n; ++c ) {
+            if (placed[c] || !freq[c]) continue;
+            double sf = 0, sb = 0;
+            int m = std::min<int>(window, chain.size());
+            for( int d=0; d<m; ++d ) {
+                sf += touch(c, chain[d]) / ( d + 1.0 );
+                sb += touch(c, chain[chain.size()-1-d]) / ( d + 1.0 );
+            }
+            // colors that touch nothing placed yet go by frequency
+            double s = std::max(sf, sb) * 1e6 + freq[c] * 1e-6;
+            if (s > top) top = s, pick = c, front = sf > sb;
+        }
+        if (front) chain.push_front(pick);
+        else chain.push_back(pick);
+        placed[pick] = true;
+        --left;
+    }
+
+    // unused colors keep their relative order at the end
+    order.assign(chain.begin(), chain.end());
+    for( int i=0; i<n; ++i )
+        if (!freq[i]) order.push_back(i);
+    return order;
+}
+
+void apply_order(QImage &img, std::vector<int> const &order)
+{
+    auto tab = img.colorTable();
+    if (img.format() != QImage::Format_Indexed8 || (int) order.size() != tab.size()) return;
+    uint8_t lut[256] = {0};
+    QVector<QRgb> t(tab.size());
+    for( int i=0; i<tab.size(); ++i ) {
+        lut[order[i]] = i;
+        t[i] = tab[order[i]];
+    }
+    for( int y=0; y<img.height(); ++y ) {
+        uint8_t *p = img.scanLine(y);
+        for( int x=0; x<img.width(); ++x )
+            p[x] = lut[p[x]];
+    }
+    img.setColorTable(t);
+}
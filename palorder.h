@@ -0,0 +1,20 @@
+#ifndef PALORDER_H
+#define PALORDER_H
+#include <vector>
+#include <QImage>
+
+/*
+ * Color table order for smaller files.
+ * Which index a color gets doesn't change how often it occurs, but PNG
+ * filters subtract neighboring indices and LZW sees the resulting byte
+ * strings. Colors that are often next to each other in the image are put at
+ * nearby indices, so those differences are small and repeat more.
+ */
+
+// order[new index] = old index, for a Format_Indexed8 image
+std::vector<int> compact_order(QImage const &img);
+
+// reorders the color table and rewrites the pixels to match, in one pass
+void apply_order(QImage &img, std::vector<int> const &order);
+
+#endif // PALORDER_H
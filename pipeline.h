@@ -0,0 +1,217 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include "vec3.h"
+
+/*
+ * Streaming scanline pipeline
+ *
+ * decode -> linearize -> quantize -> pack -> encode
+ * The quantizer emits palette indices, pack expands them for encoders
+ * that want true color.
+ * Every stage runs on its own thread and the stages are connected with
+ * bounded queues. Scanline buffers are recycled, so at most 'depth' rows
+ * are alive at any time no matter how big the image is.
+ */
+
+struct Scanline {
+    int y;
+    std::vector<uint32_t> px; // 0xffRRGGBB
+    std::vector<ivec3> lin; // linear color, 15 bits per channel
+    std::vector<uint8_t> idx; // palette index
+};
+
+struct ScanlineSource {
+    virtual ~ScanlineSource() {}
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+    virtual bool read(uint32_t *row) = 0; // fetch the next row
+};
+
+struct ScanlineSink {
+    virtual ~ScanlineSink() {}
+    virtual bool write(int y, uint32_t const *row, uint8_t const *idx) = 0;
+};
+
+template<typename T>
+class BoundedQueue {
+    std::mutex m;
+    std::condition_variable not_full, not_empty;
+    std::deque<T> q;
+    size_t cap;
+    bool closed = false;
+
+public:
+    explicit BoundedQueue(size_t c) : cap(c) {}
+
+    void push(T x)
+    {
+        std::unique_lock<std::mutex> l(m);
+        not_full.wait(l, [this]{ return q.size() < cap || closed; });
+        q.push_back(x);
+        not_empty.notify_one();
+    }
+
+    // blocks until an item is available. false when closed and drained
+    bool pop(T &x)
+    {
+        std::unique_lock<std::mutex> l(m);
+        not_empty.wait(l, [this]{ return !q.empty() || closed; });
+        if (q.empty()) return false;
+        x = q.front();
+        q.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> l(m);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+};
+
+/*
+LIN(uint32_t const *px, ivec3 *lin, int w) converts a decoded row to linear color
+QUANT(ivec3 const *lin, uint8_t *idx, int w) quantizes a row. rows arrive in order
+PACK(uint8_t const *idx, uint32_t *px, int w) converts back for the encoder
+*/
+template<typename LIN, typename QUANT, typename PACK>
+bool run_pipeline(ScanlineSource &src, ScanlineSink &dst, int depth,
+    LIN lin, QUANT quant, PACK pack)
+{
+    typedef Scanline *Row;
+    const int w = src.width(), h = src.height();
+    depth = depth < 2 ? 2 : depth;
+
+    std::vector<Scanline> rows(depth);
+    BoundedQueue<Row> q_free(depth), q_dec(depth), q_lin(depth), q_quant(depth), q_pack(depth);
+    std::atomic<bool> ok(true);
+
+    for( auto &r : rows ) {
+        r.px.resize(w);
+        r.lin.resize(w);
+        r.idx.resize(w);
+        q_free.push(&r);
+    }
+
+    auto stage = [](BoundedQueue<Row> &in, BoundedQueue<Row> &out, auto f) {
+        Row r;
+        while (in.pop(r)) {
+            f(*r);
+            out.push(r);
+        }
+        out.close();
+    };
+
+    std::thread decoder([&]() {
+        Row r;
+        for( int y=0; y<h && q_free.pop(r); ++y ) {
+            r->y = y;
+            if (!src.read(r->px.data())) {
+                ok = false;
+                break;
+            }
+            q_dec.push(r);
+        }
+        q_dec.close();
+    });
+    std::thread linearizer(stage, std::ref(q_dec), std::ref(q_lin),
+        [&](Scanline &s) { lin(s.px.data(), s.lin.data(), w); });
+    std::thread quantizer(stage, std::ref(q_lin), std::ref(q_quant),
+        [&](Scanline &s) { quant(s.lin.data(), s.idx.data(), w); });
+    std::thread packer(stage, std::ref(q_quant), std::ref(q_pack),
+        [&](Scanline &s) { pack(s.idx.data(), s.px.data(), w); });
+
+    // encoder runs on the calling thread
+    Row r;
+    while (q_pack.pop(r)) {
+        if (ok && !dst.write(r->y, r->px.data(), r->idx.data()))
+            ok = false;
+        q_free.push(r);
+    }
+
+    decoder.join();
+    linearizer.join();
+    quantizer.join();
+    packer.join();
+    return ok;
+}
+
+// binary PPM (P6, maxval 255) decoder that reads one row at a time
+class PnmSource : public ScanlineSource {
+    FILE *f;
+    int w = 0, h = 0;
+    std::vector<uint8_t> buf;
+
+    int field()
+    {
+        int c, v = 0;
+        while ((c = fgetc(f)) != EOF) {
+            if (c == '#') while ((c = fgetc(f)) != EOF && c != '\n');
+            else if (c > ' ') break;
+        }
+        for( ; c >= '0' && c <= '9'; c = fgetc(f) )
+            v = v * 10 + c - '0';
+        return v;
+    }
+
+public:
+    explicit PnmSource(FILE *fp) : f(fp)
+    {
+        if (fgetc(f) != 'P' || fgetc(f) != '6') return;
+        int ww = field(), hh = field();
+        if (field() != 255) return;
+        w = ww;
+        h = hh;
+        buf.resize(3 * w);
+    }
+
+    bool valid() const { return w > 0 && h > 0; }
+    int width() const { return w; }
+    int height() const { return h; }
+
+    bool read(uint32_t *row)
+    {
+        if (fread(buf.data(), 3, w, f) != (size_t) w) return false;
+        for( int x=0; x<w; ++x ) {
+            uint8_t const *p = &buf[3*x];
+            row[x] = 0xff000000u | p[0] << 16 | p[1] << 8 | p[2];
+        }
+        return true;
+    }
+};
+
+class PnmSink : public ScanlineSink {
+    FILE *f;
+    int w;
+    std::vector<uint8_t> buf;
+
+public:
+    PnmSink(FILE *fp, int ww, int hh) : f(fp), w(ww), buf(3 * ww)
+    {
+        fprintf(f, "P6\n%d %d\n255\n", ww, hh);
+    }
+
+    bool write(int, uint32_t const *row, uint8_t const *)
+    {
+        for( int x=0; x<w; ++x ) {
+            uint8_t *p = &buf[3*x];
+            p[0] = row[x] >> 16;
+            p[1] = row[x] >> 8;
+            p[2] = row[x];
+        }
+        return fwrite(buf.data(), 3, w, f) == (size_t) w;
+    }
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,110 @@
+#include <cmath>
+#include <vector>
+#include "quality.h"
+#include "palette.h"
+
+static double psnr(QImage const &a, QImage const &b)
+{
+    double se = 0;
+    int w = a.width(), h = a.height();
+    for( int y=0; y<h; ++y ) {
+        auto p = (QRgb const*) a.constScanLine(y);
+        auto q = (QRgb const*) b.constScanLine(y);
+        for( int x=0; x<w; ++x ) {
+            int dr = qRed(p[x]) - qRed(q[x]);
+            int dg = qGreen(p[x]) - qGreen(q[x]);
+            int db = qBlue(p[x]) - qBlue(q[x]);
+            se += dr*dr + dg*dg + db*db;
+        }
+    }
+    double mse = se / (3.0 * w * h);
+    return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 99;
+}
+
+static std::vector<float> luma(QImage const &a)
+{
+    int w = a.width(), h = a.height();
+    std::vector<float> l(w * h);
+    for( int y=0; y<h; ++y ) {
+        auto p = (QRgb const*) a.constScanLine(y);
+        for( int x=0; x<w; ++x )
+            l[y*w+x] = 0.299f*qRed(p[x]) + 0.587f*qGreen(p[x]) + 0.114f*qBlue(p[x]);
+    }
+    return l;
+}
+
+static double ssim(QImage const &a, QImage const &b)
+{
+    const int win = 8, step = 4;
+    const double c1 = 6.5025, c2 = 58.5225; // (0.01*255)^2, (0.03*255)^2
+    int w = a.width(), h = a.height();
+    auto la = luma(a), lb = luma(b);
+    double sum = 0;
+    int n = 0;
+    for( int y0=0; y0+win<=h; y0+=step ) {
+        for( int x0=0; x0+win<=w; x0+=step ) {
+            double ma=0, mb=0, vaa=0, vbb=0, vab=0;
+            for( int y=y0; y<y0+win; ++y ) {
+                for( int x=x0; x<x0+win; ++x ) {
+                    double p = la[y*w+x], q = lb[y*w+x];
+                    ma += p; mb += q;
+                    vaa += p*p; vbb += q*q; vab += p*q;
+                }
+            }
+            const double k = 1.0 / (win * win);
+            ma *= k; mb *= k;
+            vaa = vaa*k - ma*ma;
+            vbb = vbb*k - mb*mb;
+            vab = vab*k - ma*mb;
+            sum += (2*ma*mb + c1) * (2*vab + c2) / ((ma*ma + mb*mb + c1) * (vaa + vbb + c2));
+            ++n;
+        }
+    }
+    return n ? sum / n : 1;
+}
+
+static void to_lab(QRgb c, float lin[256], float lab[3])
+{
+    float r = lin[qRed(c)], g = lin[qGreen(c)], b = lin[qBlue(c)];
+    // D65 white
+    float X = (0.4124f*r + 0.3576f*g + 0.1805f*b) / 0.95047f;
+    float Y = 0.2126f*r + 0.7152f*g + 0.0722f*b;
+    float Z = (0.0193f*r + 0.1192f*g + 0.9505f*b) / 1.08883f;
+    auto f = [](float t) {
+        return t > 216.f/24389 ? cbrtf(t) : (24389.f/27 * t + 16) / 116;
+    };
+    float fx = f(X), fy = f(Y), fz = f(Z);
+    lab[0] = 116 * fy - 16;
+    lab[1] = 500 * (fx - fy);
+    lab[2] = 200 * (fy - fz);
+}
+
+static double delta_e(QImage const &a, QImage const &b)
+{
+    float lin[256];
+    for( int i=0; i<256; ++i )
+        lin[i] = sRGBtoLf(i / 255.f);
+
+    double sum = 0;
+    int w = a.width(), h = a.height();
+    for( int y=0; y<h; ++y ) {
+        auto p = (QRgb const*) a.constScanLine(y);
+        auto q = (QRgb const*) b.constScanLine(y);
+        for( int x=0; x<w; ++x ) {
+            float u[3], v[3];
+            to_lab(p[x], lin, u);
+            to_lab(q[x], lin, v);
+            sum += sqrtf((u[0]-v[0])*(u[0]-v[0]) + (u[1]-v[1])*(u[1]-v[1]) + (u[2]-v[2])*(u[2]-v[2]));
+        }
+    }
+    return sum / ((double) w * h);
+}
+
+Quality measure_quality(QImage const &ref, QImage const &img)
+{
+    QImage a = ref.convertToFormat(QImage::Format_RGB32);
+    QImage b = img.convertToFormat(QImage::Format_RGB32);
+    if (a.size() != b.size())
+        return {0, 0, 100};
+    return {psnr(a, b), ssim(a, b), delta_e(a, b)};
+}
@@ -0,0 +1,17 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+#include <QImage>
+
+/*
+ * Image quality metrics of a quantized image against its source.
+ * Both images are compared in sRGB, any format QImage can convert to RGB32.
+ */
+struct Quality {
+    double psnr; // dB over R,G,B. 99 for identical images
+    double ssim; // mean SSIM of luma, 8x8 windows
+    double delta_e; // mean CIE76 color difference in L*a*b*
+};
+
+Quality measure_quality(QImage const &ref, QImage const &img);
+
+#endif // QUALITY_H
@@ -0,0 +1,703 @@
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <QFile>
+#include "quantize.h"
+#include "palette.h"
+#include "vec3.h"
+#include "dithered.h"
+#include "bufpool.h"
+#include "riemersma.h"
+#include "scq.h"
+#include "gifwriter.h"
+#include "imgfilter.h"
+#include "trace.h"
+
+static void linearize_row(uint32_t const *s, ivec3 *d, int w)
+{
+    for( int x=0; x<w; ++x ) {
+        uint32_t rgb = s[x];
+        int b = ( rgb & 0xFF ) << 7;
+        int g = ( rgb & 0xff00 ) >> 1;
+        int r = ( rgb & 0xff0000 ) >> 9;
+        d[x] = ivec3(r,g,b).lookup(sRGBtoL_table);
+    }
+}
+
+// 0xAARRGGBB, not premultiplied. output is premultiplied
+static void linearize_row(uint32_t const *s, ivec4 *d, int w)
+{
+    for( int x=0; x<w; ++x ) {
+        uint32_t argb = s[x];
+        int b = ( argb & 0xFF ) << 7;
+        int g = ( argb & 0xff00 ) >> 1;
+        int r = ( argb & 0xff0000 ) >> 9;
+        d[x] = premultiply(ivec3(r,g,b).lookup(sRGBtoL_table), ( argb >> 24 ) * 0x7fff / 255);
+    }
+}
+
+// palette entry in the color space of the row
+static ivec3 entry(Palette const &pal, int i, ivec3) { return pal.lin[i]; }
+static ivec4 entry(Palette const &pal, int i, ivec4) { return pal.pre[i]; }
+
+// fully transparent pixels go straight to the transparent entry
+static bool clear(Palette const &, ivec3) { return false; }
+static bool clear(Palette const &pal, ivec4 c) { return c.s[3] == 0 && pal.transparent >= 0; }
+
+// color table for indexed output. always at least one entry
+static QVector<QRgb> pal_table(Palette const &pal)
+{
+    QVector<QRgb> t(std::max(pal.n, 1), qRgb(0,0,0));
+    for( int i=0; i<pal.n; ++i )
+        t[i] = (uint32_t) pal.alpha[i] << 24 | pal.rgb[i];
+    return t;
+}
+
+/*
+ * Row quantizers. Constructed with the context and image width, then fed
+ * every row of the image from top to bottom. Output is palette indices.
+ * C is ivec3 for RGB, ivec4 for premultiplied RGBA.
+ */
+template<typename C=ivec3>
+struct SimpleRows {
+    typedef C color;
+    Palette const &pal;
+    SimpleRows(QuantizerContext const &c, int) : pal(c.pal) {}
+    void operator()(C const *c, uint8_t *d, int w) {
+        for( int x=0; x<w; ++x )
+            d[x] = clear(pal, c[x]) ? pal.transparent : pal.map(c[x]);
+    }
+};
+
+template<typename T, typename C=ivec3>
+struct EDRows {
+    typedef C color;
+    Palette const &pal;
+    T ed;
+    EDRows(QuantizerContext const &c, int w) : pal(c.pal), ed(w, c.err_fract, c.pingpong, c.pool) {}
+    void operator()(C const *c, uint8_t *d, int w) {
+        int i = 0;
+        auto q = [&i, this](C x) {
+            i = pal.map(x);
+            return entry(pal, i, x);
+        };
+        // transparent pixels neither take nor pass on error
+        auto keep = [&i, this](C x) {
+            i = pal.transparent;
+            return x;
+        };
+        for( int x=0; x<w; ++x ) {
+            if (clear(pal, c[x])) ed.pixel(c[x], keep);
+            else ed.pixel(c[x], q);
+            d[x] = i;
+        }
+    }
+};
+
+/*
+ * Gray image, gray palette: the three channels are always equal, so only
+ * one is dithered. Same result as the above, a lot less work.
+ */
+struct SimpleGrayRows {
+    typedef ivec3 color;
+    Palette const &pal;
+    SimpleGrayRows(QuantizerContext const &c, int) : pal(c.pal) {}
+    void operator()(ivec3 const *c, uint8_t *d, int w) {
+        for( int x=0; x<w; ++x )
+            d[x] = pal.map_gray(c[x].s[0]);
+    }
+};
+
+template<typename T>
+struct EDGrayRows {
+    typedef ivec3 color;
+    Palette const &pal;
+    T ed;
+    EDGrayRows(QuantizerContext const &c, int w) : pal(c.pal), ed(w, c.err_fract, c.pingpong, c.pool) {}
+    void operator()(ivec3 const *c, uint8_t *d, int w) {
+        int i = 0;
+        auto q = [&i, this](int x) {
+            i = pal.map_gray(x);
+            return pal.lin[i].s[0];
+        };
+        for( int x=0; x<w; ++x ) {
+            ed.pixel(c[x].s[0], q);
+            d[x] = i;
+        }
+    }
+};
+
+// Indexed8 image. with a pool, the pixels go back to it when the image is freed
+static QImage new_indexed(QuantizerContext const &ctx, QSize sz)
+{
+    if (!ctx.pool) return QImage(sz, QImage::Format_Indexed8);
+    int bpl = ( sz.width() + 3 ) & ~3;
+    void *p = ctx.pool->get((size_t) bpl * sz.height());
+    return QImage((uchar*) p, sz.width(), sz.height(), bpl, QImage::Format_Indexed8, BufferPool::release, p);
+}
+
+/*
+ * get(y, buf) returns row y in linear color. it may convert into buf, which
+ * holds w colors, or return a row that was linearized earlier
+ */
+template<typename R, typename G>
+static QImage rows_from(QuantizerContext const &ctx, int w, int h, G get)
+{
+    QImage dst = new_indexed(ctx, QSize(w, h));
+    dst.setColorTable(pal_table(ctx.pal));
+    PoolArray<typename R::color> row(ctx.pool, w);
+    R q(ctx, w);
+    TraceAccum t_lin("linearize"), t_q("quantize");
+    for( int y=0; y<h; ++y ) {
+        t_lin.start();
+        auto c = get(y, row.data());
+        t_lin.stop();
+        t_q.start();
+        q(c, dst.scanLine(y), w);
+        t_q.stop();
+    }
+    TRACE_COUNT("pixels", (int64_t) w * h);
+    TRACE_COUNT("palette lookups", (int64_t) w * h);
+    return dst;
+}
+
+// p must be Format_RGB32, or ARGB32 for RGBA. returns Format_Indexed8
+template<typename R>
+static QImage quantize_rows(QuantizerContext const &ctx, QImage const &p)
+{
+    typedef typename R::color C;
+    int w = p.width();
+    return rows_from<R>(ctx, w, p.height(), [&p, w](int y, C *buf) -> C const* {
+        linearize_row((uint32_t const*) p.scanLine(y), buf, w);
+        return buf;
+    });
+}
+
+// lin is the whole image in linear color, w x h
+template<typename R>
+static QImage lin_rows(QuantizerContext const &ctx, typename R::color const *lin, int w, int h)
+{
+    typedef typename R::color C;
+    return rows_from<R>(ctx, w, h, [lin, w](int y, C *) -> C const* {
+        return lin + (size_t) y * w;
+    });
+}
+
+template<typename R>
+static bool stream_rows(QuantizerContext const &ctx, ScanlineSource &src, ScanlineSink &dst, int depth)
+{
+    R q(ctx, src.width());
+    auto tab = pal_table(ctx.pal);
+    auto pack_row = [&tab](uint8_t const *s, uint32_t *d, int w) {
+        for( int x=0; x<w; ++x )
+            d[x] = tab[s[x]];
+    };
+    void (*lin)(uint32_t const*, ivec3*, int) = linearize_row;
+    return run_pipeline(src, dst, depth, lin,
+        [&q](ivec3 const *c, uint8_t *d, int w) { q(c, d, w); }, pack_row);
+}
+
+/*
+ * Riemersma dither along Hilbert curves. The image is cut into TILE x TILE
+ * tiles, each walked along its own curve with its own error history. A
+ * tile's working set stays in cache however wide the image is, and tiles
+ * don't depend on each other, so they are dithered concurrently.
+ * Images are processed in strips of TILE rows.
+ */
+enum { TILE = 64 };
+
+static ThreadPool &tile_pool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+// lin and idx are w x h with stride w. h is at most TILE
+template<typename C>
+static void riemersma_strip(QuantizerContext const &ctx, C const *lin, uint8_t *idx, int w, int h)
+{
+    static const std::vector<uint16_t> curve = hilbert_curve(TILE);
+    Palette const &pal = ctx.pal;
+    std::vector<std::future<void>> tiles;
+    for( int x0=0; x0<w; x0+=TILE ) {
+        tiles.push_back(tile_pool().submit([&, x0]() {
+            DitherRiemersma<16, C> ed(ctx.err_fract);
+            int i = 0;
+            auto q = [&i, &pal](C c) {
+                i = pal.map(c);
+                return entry(pal, i, c);
+            };
+            auto keep = [&i, &pal](C c) {
+                i = pal.transparent;
+                return c;
+            };
+            for( uint16_t p : curve ) {
+                int x = x0 + ( p & 0xff ), y = p >> 8;
+                if (x >= w || y >= h) continue; // partial tile at the edge
+                C c = lin[y*w+x];
+                if (clear(pal, c)) ed.pixel(c, keep);
+                else ed.pixel(c, q);
+                idx[y*w+x] = i;
+            }
+        }));
+    }
+    for( auto &t : tiles ) t.get();
+}
+
+// get(y0, sh, buf) returns sh rows starting at y0, like rows_from. buf holds w x TILE
+template<typename C, typename G>
+static QImage tiles_from(QuantizerContext const &ctx, int w, int h, G get)
+{
+    QImage dst = new_indexed(ctx, QSize(w, h));
+    dst.setColorTable(pal_table(ctx.pal));
+    PoolArray<C> lin(ctx.pool, w * TILE);
+    PoolArray<uint8_t> idx(ctx.pool, w * TILE);
+    TraceAccum t_lin("linearize"), t_q("quantize");
+    for( int y0=0; y0<h; y0+=TILE ) {
+        int sh = std::min<int>(TILE, h - y0);
+        t_lin.start();
+        C const *c = get(y0, sh, lin.data());
+        t_lin.stop();
+        t_q.start();
+        riemersma_strip(ctx, c, idx.data(), w, sh);
+        t_q.stop();
+        for( int y=0; y<sh; ++y )
+            memcpy(dst.scanLine(y0 + y), &idx[y*w], w);
+    }
+    TRACE_COUNT("pixels", (int64_t) w * h);
+    TRACE_COUNT("palette lookups", (int64_t) w * h);
+    return dst;
+}
+
+// p must be Format_RGB32, or ARGB32 for RGBA. returns Format_Indexed8
+template<typename C>
+static QImage quantize_tiles(QuantizerContext const &ctx, QImage const &p)
+{
+    int w = p.width();
+    return tiles_from<C>(ctx, w, p.height(), [&p, w](int y0, int sh, C *buf) -> C const* {
+        for( int y=0; y<sh; ++y )
+            linearize_row((uint32_t const*) p.scanLine(y0 + y), &buf[y*w], w);
+        return buf;
+    });
+}
+
+template<typename C>
+static QImage lin_tiles(QuantizerContext const &ctx, C const *lin, int w, int h)
+{
+    return tiles_from<C>(ctx, w, h, [lin, w](int y0, int, C *) -> C const* {
+        return lin + (size_t) y0 * w;
+    });
+}
+
+// holds one strip instead of 'depth' rows, and runs its stages in turn
+static bool stream_tiles(QuantizerContext const &ctx, ScanlineSource &src, ScanlineSink &dst, int)
+{
+    int w=src.width(), h=src.height();
+    auto tab = pal_table(ctx.pal);
+    std::vector<uint32_t> px(w * TILE);
+    std::vector<ivec3> lin(w * TILE);
+    std::vector<uint8_t> idx(w * TILE);
+    for( int y0=0; y0<h; y0+=TILE ) {
+        int sh = std::min<int>(TILE, h - y0);
+        for( int y=0; y<sh; ++y ) {
+            if (!src.read(&px[y*w])) return false;
+            linearize_row(&px[y*w], &lin[y*w], w);
+        }
+        riemersma_strip(ctx, lin.data(), idx.data(), w, sh);
+        for( int i=0; i<w*sh; ++i )
+            px[i] = tab[idx[i]];
+        for( int y=0; y<sh; ++y )
+            if (!dst.write(y0 + y, &px[y*w], &idx[y*w])) return false;
+    }
+    return true;
+}
+
+/*
+ * Spatial color quantization, see scq.h. Needs the whole image at once, so
+ * the streaming version holds all of it
+ */
+template<typename C>
+static QImage lin_scq(QuantizerContext const &ctx, C const *lin, int w, int h)
+{
+    QImage dst = new_indexed(ctx, QSize(w, h));
+    dst.setColorTable(pal_table(ctx.pal));
+    PoolArray<uint8_t> idx(ctx.pool, (size_t) w * h);
+    {
+        TRACE_SCOPE("quantize");
+        spatial_quantize(ctx.pal, lin, w, h, idx.data(), tile_pool());
+    }
+    for( int y=0; y<h; ++y )
+        memcpy(dst.scanLine(y), &idx[(size_t) y * w], w);
+    TRACE_COUNT("pixels", (int64_t) w * h);
+    return dst;
+}
+
+template<typename C>
+static QImage quantize_scq(QuantizerContext const &ctx, QImage const &p)
+{
+    const int w = p.width(), h = p.height();
+    PoolArray<C> lin(ctx.pool, (size_t) w * h);
+    {
+        TRACE_SCOPE("linearize");
+        for( int y=0; y<h; ++y )
+            linearize_row((uint32_t const*) p.scanLine(y), &lin[(size_t) y * w], w);
+    }
+    return lin_scq<C>(ctx, lin.data(), w, h);
+}
+
+static bool stream_scq(QuantizerContext const &ctx, ScanlineSource &src, ScanlineSink &dst, int)
+{
+    const int w = src.width(), h = src.height();
+    std::vector<uint32_t> px((size_t) w * h);
+    std::vector<ivec3> lin((size_t) w * h);
+    std::vector<uint8_t> idx((size_t) w * h);
+    for( int y=0; y<h; ++y ) {
+        if (!src.read(&px[(size_t) y * w])) return false;
+        linearize_row(&px[(size_t) y * w], &lin[(size_t) y * w], w);
+    }
+    spatial_quantize(ctx.pal, lin.data(), w, h, idx.data(), tile_pool());
+    auto tab = pal_table(ctx.pal);
+    for( int y=0; y<h; ++y ) {
+        uint32_t *row = &px[(size_t) y * w];
+        uint8_t const *ix = &idx[(size_t) y * w];
+        for( int x=0; x<w; ++x )
+            row[x] = tab[ix[x]];
+        if (!dst.write(y, row, ix)) return false;
+    }
+    return true;
+}
+
+const QStringList qfun_names({
+"None",
+"Floyd-Steinberg",
+"Jarvis Judice Ninke",
+"Sierra 3-row",
+"Sierra 2-row",
+"Riemersma (Hilbert curve)",
+"Spatial (SCQ)",
+// "Sierra Lite",
+});
+
+const int qfun_uses[] = {
+0,
+USES_ERR_FRACT | USES_PINGPONG,
+USES_ERR_FRACT | USES_PINGPONG,
+USES_ERR_FRACT | USES_PINGPONG,
+USES_ERR_FRACT | USES_PINGPONG,
+USES_ERR_FRACT,
+FITS_PALETTE,
+};
+
+typedef QImage (*QuantizerFunc)(QuantizerContext const&, QImage const&);
+static const QuantizerFunc qfun[] = {
+quantize_rows<SimpleRows<>>,
+quantize_rows<EDRows<DitherFS>>,
+quantize_rows<EDRows<DitherJJN>>,
+quantize_rows<EDRows<DitherS3>>,
+quantize_rows<EDRows<DitherS2>>,
+quantize_tiles<ivec3>,
+quantize_scq<ivec3>,
+// quantize_rows<EDRows<DitherSL>>,
+};
+
+// used instead of qfun when the image has an alpha channel
+static const QuantizerFunc afun[] = {
+quantize_rows<SimpleRows<ivec4>>,
+quantize_rows<EDRows<DitherFSRGBA, ivec4>>,
+quantize_rows<EDRows<DitherJJNRGBA, ivec4>>,
+quantize_rows<EDRows<DitherS3RGBA, ivec4>>,
+quantize_rows<EDRows<DitherS2RGBA, ivec4>>,
+quantize_tiles<ivec4>,
+quantize_scq<ivec4>,
+};
+
+// used instead of qfun when both the image and the palette are gray
+static const QuantizerFunc gfun[] = {
+quantize_rows<SimpleGrayRows>,
+quantize_rows<EDGrayRows<DitherFSGray>>,
+quantize_rows<EDGrayRows<DitherJJNGray>>,
+quantize_rows<EDGrayRows<DitherS3Gray>>,
+quantize_rows<EDGrayRows<DitherS2Gray>>,
+nullptr,
+nullptr,
+};
+
+// same methods again, over an image that is already linearized
+template<typename C>
+using LinFunc = QImage (*)(QuantizerContext const&, C const*, int, int);
+
+static const LinFunc<ivec3> qlin[] = {
+lin_rows<SimpleRows<>>,
+lin_rows<EDRows<DitherFS>>,
+lin_rows<EDRows<DitherJJN>>,
+lin_rows<EDRows<DitherS3>>,
+lin_rows<EDRows<DitherS2>>,
+lin_tiles<ivec3>,
+lin_scq<ivec3>,
+};
+
+static const LinFunc<ivec4> alin[] = {
+lin_rows<SimpleRows<ivec4>>,
+lin_rows<EDRows<DitherFSRGBA, ivec4>>,
+lin_rows<EDRows<DitherJJNRGBA, ivec4>>,
+lin_rows<EDRows<DitherS3RGBA, ivec4>>,
+lin_rows<EDRows<DitherS2RGBA, ivec4>>,
+lin_tiles<ivec4>,
+lin_scq<ivec4>,
+};
+
+static const LinFunc<ivec3> glin[] = {
+lin_rows<SimpleGrayRows>,
+lin_rows<EDGrayRows<DitherFSGray>>,
+lin_rows<EDGrayRows<DitherJJNGray>>,
+lin_rows<EDGrayRows<DitherS3Gray>>,
+lin_rows<EDGrayRows<DitherS2Gray>>,
+nullptr,
+nullptr,
+};
+
+typedef bool (*StreamFunc)(QuantizerContext const&, ScanlineSource&, ScanlineSink&, int);
+static const StreamFunc sfun[] = {
+stream_rows<SimpleRows<>>,
+stream_rows<EDRows<DitherFS>>,
+stream_rows<EDRows<DitherJJN>>,
+stream_rows<EDRows<DitherS3>>,
+stream_rows<EDRows<DitherS2>>,
+stream_tiles,
+stream_scq,
+// stream_rows<EDRows<DitherSL>>,
+};
+
+/*
+ * gamma-correct scaling
+ * use nearest scaling when upscaling, linear? filter when downscaling
+ */
+QImage gscaled(QImage const &i, int w, int h, Qt::AspectRatioMode m, int smooth, ScaleBuffers *keep)
+{
+    TRACE_SCOPE("gscaled");
+    auto t = smooth ? //i.width() > w || i.height() > h ?
+    Qt::SmoothTransformation : Qt::FastTransformation;
+    //w &= ~3; h &= ~3;
+    ScaleBuffers tmp;
+    ScaleBuffers &b = keep ? *keep : tmp;
+    if (!i.hasAlphaChannel()) {
+        filter2_into(i, b.lin, sRGBtoL, sRGBtoL, sRGBtoL, sRGBtoL);
+        filter2_into(b.lin.scaled(w,h,m,t), b.out, LtosRGB, LtosRGB, LtosRGB, LtosRGB);
+        return b.out;
+    }
+
+    // alpha is linear already. scale premultiplied so clear pixels don't bleed
+    auto same = [](int a) { return a; };
+    filter2_into(i.convertToFormat(QImage::Format_RGBA8888), b.lin, sRGBtoL, sRGBtoL, sRGBtoL, same);
+    QImage l = b.lin.convertToFormat(QImage::Format_RGBA8888_Premultiplied).scaled(w,h,m,t);
+    filter2_into(l.convertToFormat(QImage::Format_RGBA8888), b.out, LtosRGB, LtosRGB, LtosRGB, same);
+    return b.out;
+}
+
+/*
+ * Opaque images are matched against the opaque entries only, so a dark
+ * pixel never becomes a hole. 'back' maps the indices to the full palette
+ */
+static QuantizerContext opaque_only(QuantizerContext const &ctx, uint8_t back[256])
+{
+    QuantizerContext o = ctx;
+    uint32_t c[256];
+    int n = 0;
+    for( int i=0; i<ctx.pal.n; ++i ) {
+        back[i] = i;
+        if (ctx.pal.alpha[i] == 255) {
+            back[n] = i;
+            c[n++] = ctx.pal.rgb[i];
+        }
+    }
+    if (n > 0) o.pal = Palette(c, n);
+    return o;
+}
+
+class RemapSink : public ScanlineSink {
+    ScanlineSink &dst;
+    uint8_t const *back;
+    std::vector<uint8_t> buf;
+public:
+    RemapSink(ScanlineSink &d, uint8_t const *b, int w) : dst(d), back(b), buf(w) {}
+    bool write(int y, uint32_t const *row, uint8_t const *idx)
+    {
+        for( size_t x=0; x<buf.size(); ++x )
+            buf[x] = back[idx[x]];
+        return dst.write(y, row, buf.data());
+    }
+};
+
+// p is Format_RGB32
+static QImage quantize_opaque(QuantizerContext const &ctx, QImage const &p, int mode)
+{
+    if (ctx.pal.gray && gfun[mode] && p.allGray())
+        return gfun[mode](ctx, p);
+    return qfun[mode](ctx, p);
+}
+
+static void remap(QImage &q, uint8_t const back[256], Palette const &pal)
+{
+    for( int y=0; y<q.height(); ++y ) {
+        uint8_t *d = q.scanLine(y);
+        for( int x=0; x<q.width(); ++x )
+            d[x] = back[d[x]];
+    }
+    q.setColorTable(pal_table(pal));
+}
+
+QImage quantizeImg(QuantizerContext const &ctx, QImage const &p, int mode)
+{
+    if (p.hasAlphaChannel())
+        return afun[mode](ctx, p.convertToFormat(QImage::Format_ARGB32));
+
+    QImage rgb = p.convertToFormat(QImage::Format_RGB32);
+    if (!ctx.pal.has_alpha)
+        return quantize_opaque(ctx, rgb, mode);
+
+    uint8_t back[256];
+    QImage q = quantize_opaque(opaque_only(ctx, back), rgb, mode);
+    remap(q, back, ctx.pal);
+    return q;
+}
+
+QImage quantizeSpatial(QuantizerContext const &ctx, QImage const &p)
+{
+    TRACE_SCOPE("quantizeSpatial");
+    QImage rgb = p.convertToFormat(QImage::Format_RGB32);
+    const int w = rgb.width(), h = rgb.height();
+    uint8_t back[256];
+    QuantizerContext o = opaque_only(ctx, back);
+
+    std::vector<ivec3> lin((size_t) w * h), fit(std::max(o.pal.n, 1));
+    for( int y=0; y<h; ++y )
+        linearize_row((uint32_t const*) rgb.constScanLine(y), &lin[(size_t) y * w], w);
+    QImage dst(w, h, QImage::Format_Indexed8);
+    std::vector<uint8_t> idx((size_t) w * h);
+    spatial_quantize(o.pal, lin.data(), w, h, idx.data(), tile_pool(), fit.data());
+
+    auto tab = pal_table(ctx.pal);
+    auto to8 = [](int v) { return ( LtosRGB(v) * 255 + 0x3fff ) / 0x7fff; };
+    for( int i=0; i<o.pal.n; ++i )
+        tab[back[i]] = qRgb(to8(fit[i].s[0]), to8(fit[i].s[1]), to8(fit[i].s[2]));
+    dst.setColorTable(tab);
+    for( int y=0; y<h; ++y ) {
+        uint8_t *d = dst.scanLine(y);
+        for( int x=0; x<w; ++x )
+            d[x] = back[idx[(size_t) y * w + x]];
+    }
+    return dst;
+}
+
+bool quantizeStream(QuantizerContext const &ctx, ScanlineSource &src, ScanlineSink &dst, int mode, int depth)
+{
+    if (!ctx.pal.has_alpha)
+        return sfun[mode](ctx, src, dst, depth);
+    uint8_t back[256];
+    QuantizerContext o = opaque_only(ctx, back);
+    RemapSink r(dst, back, src.width());
+    return sfun[mode](o, src, r, depth);
+}
+
+std::vector<QImage> quantizeBatch(ThreadPool &pool, std::vector<QuantizeJob> const &jobs)
+{
+    std::vector<std::future<QImage>> res;
+    for( auto const &j : jobs )
+        res.push_back(pool.submit([&j]() { return quantizeImg(*j.ctx, j.src, j.mode); }));
+    std::vector<QImage> out;
+    for( auto &r : res )
+        out.push_back(r.get());
+    return out;
+}
+
+/*
+ * p is linearized once, in bands, then every method runs on it at the
+ * same time. gfun is used where it has an entry, like quantize_opaque does.
+ * back is null, or maps the indices to the full palette
+ */
+template<typename C>
+static std::vector<MethodResult> quantize_all(ThreadPool &pool, QuantizerContext const &ctx, QImage const &p,
+    LinFunc<C> const *fun, LinFunc<C> const *gray, uint8_t const *back, Palette const &full)
+{
+    const int w = p.width(), h = p.height(), n = qfun_names.size();
+    std::vector<C> lin((size_t) w * h);
+    {
+        TRACE_SCOPE("linearize");
+        std::vector<std::future<void>> bands;
+        int nb = std::max(std::min(pool.size(), h), 1);
+        for( int i=0; i<nb; ++i ) {
+            int y0 = h * i / nb, y1 = h * ( i + 1 ) / nb;
+            bands.push_back(pool.submit([&, y0, y1]() {
+                for( int y=y0; y<y1; ++y )
+                    linearize_row((uint32_t const*) p.constScanLine(y), &lin[(size_t) y * w], w);
+            }));
+        }
+        for( auto &b : bands ) b.get();
+    }
+
+    std::vector<std::future<MethodResult>> jobs;
+    for( int m=0; m<n; ++m ) {
+        LinFunc<C> f = gray && gray[m] ? gray[m] : fun[m];
+        jobs.push_back(pool.submit([&, f]() {
+            MethodResult r;
+            auto t0 = std::chrono::steady_clock::now();
+            r.img = f(ctx, lin.data(), w, h);
+            r.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            if (back) remap(r.img, back, full);
+            r.quality = measure_quality(p, r.img);
+            return r;
+        }));
+    }
+    std::vector<MethodResult> out;
+    for( auto &j : jobs )
+        out.push_back(j.get());
+    return out;
+}
+
+std::vector<MethodResult> quantizeAll(ThreadPool &pool, QuantizerContext const &ctx, QImage const &p)
+{
+    TRACE_SCOPE("quantizeAll");
+    if (p.hasAlphaChannel())
+        return quantize_all<ivec4>(pool, ctx, p.convertToFormat(QImage::Format_ARGB32), alin, nullptr, nullptr, ctx.pal);
+
+    QImage rgb = p.convertToFormat(QImage::Format_RGB32);
+    uint8_t back[256];
+    QuantizerContext o;
+    bool remapped = ctx.pal.has_alpha;
+    if (remapped) o = opaque_only(ctx, back);
+    QuantizerContext const &c = remapped ? o : ctx;
+    bool gray = c.pal.gray && rgb.allGray();
+    return quantize_all<ivec3>(pool, c, rgb, qlin, gray ? glin : nullptr, remapped ? back : nullptr, ctx.pal);
+}
+
+bool QImageSource::read(uint32_t *row)
+{
+    if (y >= img.height()) return false;
+    memcpy(row, img.constScanLine(y++), img.width() * 4);
+    return true;
+}
+
+bool QImageSink::write(int y, uint32_t const *row, uint8_t const *)
+{
+    memcpy(img.scanLine(y), row, img.width() * 4);
+    return true;
+}
+
+bool saveIndexed(QImage const &img, QString const &path)
+{
+    if (!path.endsWith(".gif", Qt::CaseInsensitive))
+        return img.save(path); // Qt writes Indexed8 images as paletted PNG
+
+    FILE *f = fopen(QFile::encodeName(path).constData(), "wb");
+    if (!f) return false;
+    auto tab = img.colorTable();
+    int clear = -1; // GIF has one fully transparent index at most
+    for( int i=tab.size()-1; i>=0; --i )
+        if (qAlpha(tab[i]) == 0) clear = i;
+    GifWriter gif(f, img.width(), img.height(), tab.data(), tab.size(), clear);
+    for( int y=0; y<img.height(); ++y )
+        gif.write_row(img.constScanLine(y));
+    bool ok = gif.finish();
+    return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,77 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+#include <vector>
+#include <QImage>
+#include <QStringList>
+#include "palette.h"
+#include "pipeline.h"
+#include "threadpool.h"
+#include "quality.h"
+
+extern const QStringList qfun_names;
+
+// settings of QuantizerContext that a method reads, per qfun_names entry.
+// FITS_PALETTE: quantizeSpatial can optimize the palette along with it
+enum { USES_ERR_FRACT = 1, USES_PINGPONG = 2, FITS_PALETTE = 4 };
+extern const int qfun_uses[];
+
+// intermediates of gscaled. keep one per view to reuse them between frames
+struct ScaleBuffers {
+    QImage rgb; // for callers that expand indexed images first
+    QImage lin, out;
+};
+
+// gamma-correct scaling
+QImage gscaled(QImage const &i, int w, int h, Qt::AspectRatioMode m, int smooth=1, ScaleBuffers *keep=nullptr);
+
+// quantize the whole image. returns Format_Indexed8
+QImage quantizeImg(QuantizerContext const &ctx, QImage const &p, int mode);
+
+// spatial quantization (scq.h) that moves the colors of the palette too.
+// the color table of the result holds them. transparency is dropped
+QImage quantizeSpatial(QuantizerContext const &ctx, QImage const &p);
+
+// same, but one scanline at a time. memory use is bounded by 'depth' rows
+bool quantizeStream(QuantizerContext const &ctx, ScanlineSource &src, ScanlineSink &dst, int mode, int depth=8);
+
+// independent jobs, run concurrently. contexts may be shared between jobs
+struct QuantizeJob {
+    QuantizerContext const *ctx;
+    QImage src;
+    int mode;
+};
+std::vector<QImage> quantizeBatch(ThreadPool &pool, std::vector<QuantizeJob> const &jobs);
+
+// one result of quantizeAll
+struct MethodResult {
+    QImage img; // Format_Indexed8
+    double ms; // time spent in the quantizer, not counting the shared linearization
+    Quality quality; // against the source
+};
+
+// every method of qfun_names over the same image, concurrently. the image is
+// linearized once for all of them. results are in qfun_names order
+std::vector<MethodResult> quantizeAll(ThreadPool &pool, QuantizerContext const &ctx, QImage const &p);
+
+// paletted PNG, or GIF if the file name ends with .gif
+bool saveIndexed(QImage const &img, QString const &path);
+
+// adapters for streaming from/to images that are already in memory
+class QImageSource : public ScanlineSource {
+    QImage img;
+    int y = 0;
+public:
+    explicit QImageSource(QImage const &i) : img(i.convertToFormat(QImage::Format_RGB32)) {}
+    int width() const { return img.width(); }
+    int height() const { return img.height(); }
+    bool read(uint32_t *row);
+};
+
+class QImageSink : public ScanlineSink {
+public:
+    QImage img;
+    QImageSink(int w, int h) : img(w, h, QImage::Format_RGB32) {}
+    bool write(int y, uint32_t const *row, uint8_t const *idx);
+};
+
+#endif // QUANTIZE_H
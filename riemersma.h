@@ -0,0 +1,87 @@
+#ifndef RIEMERSMA_H
+#define RIEMERSMA_H
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Riemersma dithering
+ *
+COLOR is an ivec3 or ivec4 with 15 bit channels.
+Pixels are visited along a space filling curve instead of row by row.
+The quantization error of the last 'len' pixels is kept in a ring buffer
+and added to the next pixel with exponentially decaying weights, the
+newest error weighs 'ratio' times more than the oldest one. Weights add
+up to 1 so the total error is preserved, as with the DitherED kernels.
+There is no scan direction, so no directional artifacts either.
+*/
+template<int len, typename COLOR>
+struct DitherRiemersma {
+
+    COLOR hist[len]; // hist[head] is the newest error
+    int weight[len]; // 12 bits of fraction. weight[0] is for the newest error
+    int head = 0;
+    int err_fract; // 10 bits of fraction, same as DitherED
+
+    DitherRiemersma(int fract=1024, double ratio=16)
+    {
+        err_fract = fract;
+        double w[len], sum = 0;
+        for( int i=0; i<len; ++i )
+            sum += w[i] = std::pow(ratio, -i / (len - 1.0));
+        for( int i=0; i<len; ++i ) {
+            weight[i] = (int) std::lround(w[i] / sum * 4096);
+            hist[i] = COLOR(0);
+        }
+    }
+
+    template<typename Q>
+    COLOR pixel(COLOR c0, Q quantized)
+    {
+        COLOR acc(0);
+        for( int i=0; i<len; ++i )
+            acc += hist[(head + i) % len] * weight[i];
+        COLOR c = c0 - (acc >> 12);
+        for( auto &x : c.s )
+            x = std::min(std::max(x, 0), 0x7fff); // keep the error from winding up
+        COLOR c1 = quantized(c);
+        COLOR e = c1 - c; // includes the error carried in, or it could never add up
+        head = (head + len - 1) % len; // the oldest error drops out
+        hist[head] = e * err_fract >> 10;
+        return c1;
+    }
+};
+
+/*
+ * Hilbert curve over an n x n square, n a power of two and at most 256.
+ * Returns the visiting order, each point packed as y << 8 | x
+ */
+inline std::vector<uint16_t> hilbert_curve(int n)
+{
+    std::vector<uint16_t> c(n * n);
+    for( int d=0; d<n*n; ++d ) {
+        int x = 0, y = 0, t = d;
+        for( int s=1; s<n; s*=2 ) {
+            int rx = 1 & ( t / 2 );
+            int ry = 1 & ( t ^ rx );
+            if (!ry) {
+                // rotate the quadrant
+                if (rx) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                int tmp = x;
+                x = y;
+                y = tmp;
+            }
+            x += s * rx;
+            y += s * ry;
+            t /= 4;
+        }
+        c[d] = y << 8 | x;
+    }
+    return c;
+}
+
+#endif // RIEMERSMA_H
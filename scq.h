@@ -0,0 +1,356 @@
+#ifndef SCQ_H
+#define SCQ_H
+#include <cmath>
+#include <array>
+#include <vector>
+#include <future>
+#include <cstdint>
+#include <algorithm>
+#include "vec3.h"
+#include "palette.h"
+#include "threadpool.h"
+
+/*
+ * Spatial color quantization
+ *
+Chooses the index of every pixel so that the image and the output look the
+same through a small blur, the low pass of the eye: minimizes the sum of
+|b * (x - pal[idx])|^2 over the image, b the 3x3 binomial kernel. Dither
+patterns come out of that on their own, there is no error to diffuse.
+
+- Coarse to fine. Solved on a 2x2 box pyramid from the smallest level up,
+  each level starting from the indices of the one below, so the fine
+  levels only have to fix details.
+- A pixel's choice reads and writes the blurred error within one pixel of
+  it, so pixels three apart in both directions don't interact. Each of the
+  9 phases of a 3x3 checkerboard is updated in parallel, in row bands.
+- Only pixels within two of a change in the last sweep are looked at again,
+  and a level ends when a sweep changes almost nothing.
+
+With 'means' the palette is optimized together with the indices: after
+each level the colors are set to the least squares solution of the same
+blurred error, and the finest level is solved once more with them.
+*/
+
+namespace scq {
+
+typedef std::array<float,4> Px;
+
+template<typename C> struct Channels { enum { n = 4 }; };
+template<> struct Channels<ivec3> { enum { n = 3 }; };
+
+inline ivec3 entry(Palette const &pal, int i, ivec3) { return pal.lin[i]; }
+inline ivec4 entry(Palette const &pal, int i, ivec4) { return pal.pre[i]; }
+
+// fully transparent pixels stay on the transparent entry
+inline bool clear(Palette const &, ivec3) { return false; }
+inline bool clear(Palette const &pal, ivec4 c) { return c.s[3] == 0 && pal.transparent >= 0; }
+
+const float K[3] = {0.25f, 0.5f, 0.25f};
+
+struct Level {
+    int w, h;
+    std::vector<Px> x; // target, linear
+    std::vector<uint8_t> lock; // pixels that keep their index
+};
+
+class Solver {
+    Level const &L;
+    std::vector<Px> const &col;
+    int n, nc;
+    std::vector<float> d2; // |col[i] - col[j]|^2
+    std::vector<Px> f; // blurred error
+    std::vector<uint8_t> active, changed;
+
+    Px blur_error(uint8_t const *idx, int x, int y) const
+    {
+        Px s = {{0, 0, 0, 0}};
+        for( int dy=-1; dy<=1; ++dy )
+            for( int dx=-1; dx<=1; ++dx ) {
+                int u = x + dx, v = y + dy;
+                if (u < 0 || v < 0 || u >= L.w || v >= L.h) continue;
+                float k = K[dx+1] * K[dy+1];
+                size_t q = (size_t) v * L.w + u;
+                for( int c=0; c<nc; ++c )
+                    s[c] += k * ( L.x[q][c] - col[idx[q]][c] );
+            }
+        return s;
+    }
+
+    // best index for one pixel given all others. true if it changed
+    bool update(uint8_t *idx, int x, int y)
+    {
+        Px a = {{0, 0, 0, 0}};
+        float S = 0;
+        for( int dy=-1; dy<=1; ++dy )
+            for( int dx=-1; dx<=1; ++dx ) {
+                int u = x + dx, v = y + dy;
+                if (u < 0 || v < 0 || u >= L.w || v >= L.h) continue;
+                float k = K[dx+1] * K[dy+1];
+                Px const &fq = f[(size_t) v * L.w + u];
+                for( int c=0; c<nc; ++c ) a[c] += k * fq[c];
+                S += k * k;
+            }
+        size_t p = (size_t) y * L.w + x;
+        int old = idx[p], best = old;
+        // energy change of old -> j is 2 (col[old] - col[j]).a + S |col[old] - col[j]|^2
+        float ao = 0;
+        for( int c=0; c<nc; ++c ) ao += col[old][c] * a[c];
+        float top = -1; // ignore changes lost in rounding
+        float const *dr = &d2[old * n];
+        for( int j=0; j<n; ++j ) {
+            float aj = 0;
+            for( int c=0; c<nc; ++c ) aj += col[j][c] * a[c];
+            float d = 2 * ( ao - aj ) + S * dr[j];
+            if (d < top) {
+                top = d;
+                best = j;
+            }
+        }
+        if (best == old) return false;
+        Px delta;
+        for( int c=0; c<4; ++c ) delta[c] = col[old][c] - col[best][c];
+        for( int dy=-1; dy<=1; ++dy )
+            for( int dx=-1; dx<=1; ++dx ) {
+                int u = x + dx, v = y + dy;
+                if (u < 0 || v < 0 || u >= L.w || v >= L.h) continue;
+                float k = K[dx+1] * K[dy+1];
+                Px &fq = f[(size_t) v * L.w + u];
+                for( int c=0; c<nc; ++c ) fq[c] += k * delta[c];
+            }
+        idx[p] = best;
+        return true;
+    }
+
+public:
+    Solver(Level const &l, std::vector<Px> const &c, int channels)
+        : L(l), col(c), n(c.size()), nc(channels), d2(n * n)
+    {
+        for( int i=0; i<n; ++i )
+            for( int j=0; j<n; ++j ) {
+                float s = 0;
+                for( int k=0; k<nc; ++k ) s += ( col[i][k] - col[j][k] ) * ( col[i][k] - col[j][k] );
+                d2[i*n+j] = s;
+            }
+    }
+
+    void run(uint8_t *idx, ThreadPool &pool, int max_sweeps)
+    {
+        const int w = L.w, h = L.h;
+        f.resize((size_t) w * h);
+        for( int y=0; y<h; ++y )
+            for( int x=0; x<w; ++x )
+                f[(size_t) y * w + x] = blur_error(idx, x, y);
+        active.assign((size_t) w * h, 1);
+        changed.assign((size_t) w * h, 0);
+
+        const int bands = std::max(std::min(pool.size(), ( h + 2 ) / 3), 1);
+        for( int sweep=0; sweep<max_sweeps; ++sweep ) {
+            long moved = 0;
+            for( int phase=0; phase<9; ++phase ) {
+                const int px = phase % 3, py = phase / 3;
+                const int rows = ( h - py + 2 ) / 3; // rows py, py+3, ...
+                std::vector<std::future<long>> jobs;
+                for( int b=0; b<bands; ++b ) {
+                    int r0 = rows * b / bands, r1 = rows * ( b + 1 ) / bands;
+                    jobs.push_back(pool.submit([=]() {
+                        long m = 0;
+                        for( int r=r0; r<r1; ++r ) {
+                            int y = py + 3 * r;
+                            for( int x=px; x<w; x+=3 ) {
+                                size_t p = (size_t) y * w + x;
+                                if (!active[p] || L.lock[p]) continue;
+                                if (update(idx, x, y)) {
+                                    changed[p] = 1;
+                                    ++m;
+                                }
+                            }
+                        }
+                        return m;
+                    }));
+                }
+                for( auto &j : jobs ) moved += j.get();
+            }
+            if (moved * 2000 <= (long) w * h) break; // settled
+
+            // look again at whatever the changes could have affected
+            std::fill(active.begin(), active.end(), 0);
+            for( int y=0; y<h; ++y )
+                for( int x=0; x<w; ++x ) {
+                    if (!changed[(size_t) y * w + x]) continue;
+                    for( int v=std::max(y-2, 0); v<=std::min(y+2, h-1); ++v )
+                        for( int u=std::max(x-2, 0); u<=std::min(x+2, w-1); ++u )
+                            active[(size_t) v * w + u] = 1;
+                }
+            std::fill(changed.begin(), changed.end(), 0);
+        }
+    }
+};
+
+// half the size, 2x2 box. odd edges repeat the last pixel
+inline Level downsample(Level const &a)
+{
+    Level b;
+    b.w = ( a.w + 1 ) / 2;
+    b.h = ( a.h + 1 ) / 2;
+    b.x.resize((size_t) b.w * b.h);
+    b.lock.assign(b.x.size(), 0);
+    for( int y=0; y<b.h; ++y )
+        for( int x=0; x<b.w; ++x ) {
+            Px s = {{0, 0, 0, 0}};
+            for( int v=0; v<2; ++v )
+                for( int u=0; u<2; ++u ) {
+                    int sx = std::min(2*x+u, a.w-1), sy = std::min(2*y+v, a.h-1);
+                    Px const &p = a.x[(size_t) sy * a.w + sx];
+                    for( int c=0; c<4; ++c ) s[c] += 0.25f * p[c];
+                }
+            b.x[(size_t) y * b.w + x] = s;
+        }
+    return b;
+}
+
+/*
+ * Least squares colors for fixed indices. With B_j the blurred indicator of
+ * entry j and Bx the blurred image, solves sum_k (B_j.B_k) col_k = B_j.Bx.
+ * Entries that are barely used are pulled towards their old color
+ */
+inline void fit_colors(Level const &L, uint8_t const *idx, std::vector<Px> &col, int nc)
+{
+    const int n = col.size(), w = L.w, h = L.h;
+    std::vector<double> A((size_t) n * n, 0.0), r((size_t) n * 4, 0.0);
+    for( int y=0; y<h; ++y )
+        for( int x=0; x<w; ++x ) {
+            // the blurred indicators at (x, y) are nonzero for at most 9 entries
+            int ids[9], m = 0;
+            double wt[9];
+            double bx[4] = {0, 0, 0, 0};
+            for( int dy=-1; dy<=1; ++dy )
+                for( int dx=-1; dx<=1; ++dx ) {
+                    int u = x + dx, v = y + dy;
+                    if (u < 0 || v < 0 || u >= w || v >= h) continue;
+                    double k = K[dx+1] * K[dy+1];
+                    size_t q = (size_t) v * w + u;
+                    int j = idx[q], t = 0;
+                    while (t < m && ids[t] != j) ++t;
+                    if (t == m) {
+                        ids[m] = j;
+                        wt[m++] = 0;
+                    }
+                    wt[t] += k;
+                    for( int c=0; c<nc; ++c ) bx[c] += k * L.x[q][c];
+                }
+            for( int s=0; s<m; ++s ) {
+                for( int t=0; t<m; ++t )
+                    A[(size_t) ids[s] * n + ids[t]] += wt[s] * wt[t];
+                for( int c=0; c<nc; ++c )
+                    r[(size_t) ids[s] * 4 + c] += wt[s] * bx[c];
+            }
+        }
+
+    double tr = 0;
+    for( int j=0; j<n; ++j ) tr += A[(size_t) j * n + j];
+    const double lambda = 1e-4 * tr / n + 1e-9;
+    for( int j=0; j<n; ++j ) {
+        A[(size_t) j * n + j] += lambda;
+        for( int c=0; c<nc; ++c ) r[(size_t) j * 4 + c] += lambda * col[j][c];
+    }
+
+    // gaussian elimination, the matrix is symmetric positive definite
+    for( int i=0; i<n; ++i ) {
+        double piv = A[(size_t) i * n + i];
+        for( int k=i+1; k<n; ++k ) {
+            double f = A[(size_t) k * n + i] / piv;
+            if (f == 0) continue;
+            for( int j=i; j<n; ++j ) A[(size_t) k * n + j] -= f * A[(size_t) i * n + j];
+            for( int c=0; c<nc; ++c ) r[(size_t) k * 4 + c] -= f * r[(size_t) i * 4 + c];
+        }
+    }
+    for( int i=n-1; i>=0; --i )
+        for( int c=0; c<nc; ++c ) {
+            double s = r[(size_t) i * 4 + c];
+            for( int j=i+1; j<n; ++j ) s -= A[(size_t) i * n + j] * col[j][c];
+            col[i][c] = std::min(std::max(s / A[(size_t) i * n + i], 0.0), 32767.0);
+        }
+}
+
+} // namespace scq
+
+/*
+lin: w x h pixels in the color space of C, see quantize.cpp. idx gets w x h indices.
+means: optional, pal.n colors. when given the palette is optimized too and the
+colors it ends up with are returned there
+*/
+template<typename C>
+void spatial_quantize(Palette const &pal, C const *lin, int w, int h, uint8_t *idx, ThreadPool &pool, C *means=nullptr)
+{
+    using namespace scq;
+    const int nc = Channels<C>::n;
+    if (w <= 0 || h <= 0 || pal.n <= 0) return;
+
+    std::vector<Px> col(pal.n);
+    for( int i=0; i<pal.n; ++i ) {
+        C e = scq::entry(pal, i, C());
+        col[i] = {{0, 0, 0, 0}};
+        for( int c=0; c<nc; ++c ) col[i][c] = e.s[c];
+    }
+
+    std::vector<Level> levels(1);
+    Level &top = levels[0];
+    top.w = w;
+    top.h = h;
+    top.x.resize((size_t) w * h);
+    top.lock.assign(top.x.size(), 0);
+    for( size_t p=0; p<top.x.size(); ++p ) {
+        top.x[p] = {{0, 0, 0, 0}};
+        for( int c=0; c<nc; ++c ) top.x[p][c] = lin[p].s[c];
+        top.lock[p] = scq::clear(pal, lin[p]);
+    }
+    while (levels.back().w > 64 || levels.back().h > 64)
+        levels.push_back(downsample(levels.back()));
+
+    // the coarsest level starts from the nearest colors
+    std::vector<uint8_t> cur;
+    {
+        Level const &L = levels.back();
+        cur.resize(L.x.size());
+        for( size_t p=0; p<L.x.size(); ++p ) {
+            float best = INFINITY;
+            for( int j=0; j<pal.n; ++j ) {
+                float d = 0;
+                for( int c=0; c<nc; ++c ) d += ( L.x[p][c] - col[j][c] ) * ( L.x[p][c] - col[j][c] );
+                if (d < best) {
+                    best = d;
+                    cur[p] = j;
+                }
+            }
+        }
+    }
+
+    for( int l=levels.size()-1; l>=0; --l ) {
+        Level const &L = levels[l];
+        if (l < (int) levels.size() - 1) {
+            Level const &c = levels[l+1];
+            std::vector<uint8_t> up(L.x.size());
+            for( int y=0; y<L.h; ++y )
+                for( int x=0; x<L.w; ++x )
+                    up[(size_t) y * L.w + x] = cur[(size_t) std::min(y/2, c.h-1) * c.w + std::min(x/2, c.w-1)];
+            cur.swap(up);
+        }
+        for( size_t p=0; p<L.x.size(); ++p )
+            if (L.lock[p]) cur[p] = pal.transparent;
+        Solver(L, col, nc).run(cur.data(), pool, l ? 16 : 8);
+        if (means) {
+            fit_colors(L, cur.data(), col, nc);
+            if (!l) Solver(L, col, nc).run(cur.data(), pool, 8);
+        }
+    }
+
+    std::copy(cur.begin(), cur.end(), idx);
+    if (means)
+        for( int i=0; i<pal.n; ++i ) {
+            means[i] = scq::entry(pal, i, C());
+            for( int c=0; c<nc; ++c ) means[i].s[c] = (int) std::lround(col[i][c]);
+        }
+}
+
+#endif // SCQ_H
@@ -0,0 +1,72 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <future>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+/*
+ * Fixed size pool of worker threads. submit() returns a future for the
+ * result. The destructor finishes every queued job before returning.
+ */
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex m;
+    std::condition_variable cv;
+    bool stopping = false;
+
+    void work()
+    {
+        for(;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> l(m);
+                cv.wait(l, [this]{ return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+public:
+    explicit ThreadPool(int n = 0)
+    {
+        if (n <= 0) n = std::max(1u, std::thread::hardware_concurrency());
+        for( int i=0; i<n; ++i )
+            workers.emplace_back(&ThreadPool::work, this);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> l(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        for( auto &t : workers ) t.join();
+    }
+
+    int size() const { return workers.size(); }
+
+    template<typename F>
+    auto submit(F f) -> std::future<decltype(f())>
+    {
+        auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+        auto fut = task->get_future();
+        {
+            std::lock_guard<std::mutex> l(m);
+            jobs.emplace_back([task]() { (*task)(); });
+        }
+        cv.notify_one();
+        return fut;
+    }
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,136 @@
+#include "trace.h"
+#ifdef MANPAL_TRACE
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Event {
+    const char *name;
+    int64_t t0, dur;
+    int tid;
+};
+
+struct Stage {
+    const char *name;
+    int64_t value;
+    bool counter;
+};
+
+std::mutex mtx;
+std::vector<Stage> frame;
+std::vector<Event> events;
+const char *json_path = nullptr;
+bool json_checked = false;
+const size_t max_events = 1 << 20;
+
+int thread_index()
+{
+    static int next = 0;
+    thread_local int id = -1;
+    if (id < 0) {
+        std::lock_guard<std::mutex> l(mtx);
+        id = next++;
+    }
+    return id;
+}
+
+void write_json()
+{
+    FILE *f = fopen(json_path, "w");
+    if (!f) return;
+    fprintf(f, "{\"traceEvents\": [\n");
+    for( size_t i=0; i<events.size(); ++i ) {
+        auto const &e = events[i];
+        fprintf(f, "{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d, ",
+            e.name, e.dur < 0 ? 'C' : 'X', e.t0 * 1e-3, e.tid);
+        if (e.dur < 0)
+            fprintf(f, "\"args\": {\"value\": %lld}}", (long long) -e.dur - 1);
+        else
+            fprintf(f, "\"dur\": %.3f}", e.dur * 1e-3);
+        fprintf(f, "%s\n", i + 1 < events.size() ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    fclose(f);
+}
+
+// call with mtx held
+void record(Event e)
+{
+    if (!json_checked) {
+        json_checked = true;
+        json_path = getenv("MANPAL_TRACE_JSON");
+        if (json_path) atexit(write_json);
+    }
+    if (json_path && events.size() < max_events)
+        events.push_back(e);
+}
+
+// call with mtx held
+void accumulate(const char *name, int64_t v, bool counter)
+{
+    for( auto &s : frame ) {
+        if (!strcmp(s.name, name)) {
+            s.value += v;
+            return;
+        }
+    }
+    frame.push_back({name, v, counter});
+}
+
+} // namespace
+
+int64_t trace_now()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void trace_event(const char *name, int64_t t0, int64_t t1)
+{
+    int tid = thread_index();
+    std::lock_guard<std::mutex> l(mtx);
+    accumulate(name, t1 - t0, false);
+    record({name, t0, t1 - t0, tid});
+}
+
+void trace_add(const char *name, int64_t ns)
+{
+    std::lock_guard<std::mutex> l(mtx);
+    accumulate(name, ns, false);
+}
+
+void trace_count(const char *name, int64_t n)
+{
+    int64_t t = trace_now();
+    int tid = thread_index();
+    std::lock_guard<std::mutex> l(mtx);
+    accumulate(name, n, true);
+    for( auto &s : frame ) {
+        // counter events carry the running total, encoded as -(value+1)
+        if (!strcmp(s.name, name)) record({name, t, -s.value - 1, tid});
+    }
+}
+
+std::string trace_frame()
+{
+    std::lock_guard<std::mutex> l(mtx);
+    std::string s;
+    char buf[96];
+    for( auto const &x : frame ) {
+        if (x.counter)
+            snprintf(buf, sizeof buf, "%s%s %lld", s.empty() ? "" : ", ", x.name, (long long) x.value);
+        else
+            snprintf(buf, sizeof buf, "%s%s %.2f ms", s.empty() ? "" : ", ", x.name, x.value * 1e-6);
+        s += buf;
+    }
+    frame.clear();
+    return s;
+}
+
+#endif // MANPAL_TRACE
@@ -0,0 +1,58 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Stage timers and counters. Build with 'qmake CONFIG+=trace' to enable,
+ * otherwise everything below compiles to nothing.
+ *
+ * TRACE_SCOPE("name") times the rest of the enclosing block.
+ * TraceAccum sums a stage that runs in many small pieces (e.g. per row).
+ * trace_frame() returns the stage times collected since its last call.
+ * With MANPAL_TRACE_JSON=file.json in the environment every scope is also
+ * recorded and written as a Chrome trace (chrome://tracing) at exit.
+ */
+
+#ifdef MANPAL_TRACE
+#include <cstdint>
+#include <string>
+
+int64_t trace_now(); // ns
+void trace_event(const char *name, int64_t t0, int64_t t1);
+void trace_add(const char *name, int64_t ns);
+void trace_count(const char *name, int64_t n);
+std::string trace_frame();
+
+struct TraceScope {
+    const char *name;
+    int64_t t0;
+    TraceScope(const char *n) : name(n), t0(trace_now()) {}
+    ~TraceScope() { trace_event(name, t0, trace_now()); }
+};
+
+struct TraceAccum {
+    const char *name;
+    int64_t total = 0, t0 = 0;
+    TraceAccum(const char *n) : name(n) {}
+    ~TraceAccum() { trace_add(name, total); }
+    void start() { t0 = trace_now(); }
+    void stop() { total += trace_now() - t0; }
+};
+
+#define TRACE_CAT2(a,b) a##b
+#define TRACE_CAT(a,b) TRACE_CAT2(a,b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CAT(trace_scope_, __LINE__)(name)
+#define TRACE_COUNT(name, n) trace_count(name, n)
+
+#else
+
+struct TraceAccum {
+    TraceAccum(const char *) {}
+    void start() {}
+    void stop() {}
+};
+
+#define TRACE_SCOPE(name) do {} while(0)
+#define TRACE_COUNT(name, n) do {} while(0)
+
+#endif // MANPAL_TRACE
+#endif // TRACE_H
@@ -0,0 +1,125 @@
+#include <cstdio>
+#include <algorithm>
+#include "tuner.h"
+#include "quantize.h"
+#include "quality.h"
+#include "histogram.h"
+#include "gifwriter.h"
+#include "trace.h"
+
+// size of q when saved as GIF
+static long gif_bytes(QImage const &q)
+{
+    FILE *f = tmpfile();
+    if (!f) return -1;
+    auto tab = q.colorTable();
+    {
+        GifWriter gif(f, q.width(), q.height(), tab.data(), tab.size());
+        for( int y=0; y<q.height(); ++y )
+            gif.write_row(q.constScanLine(y));
+        gif.finish();
+    }
+    long n = ftell(f);
+    fclose(f);
+    return n;
+}
+
+static TuneResult score(QImage const &img, TuneResult r, Palette const &pal)
+{
+    QuantizerContext ctx;
+    ctx.pal = pal;
+    ctx.err_fract = r.err_fract;
+    ctx.pingpong = r.pingpong;
+    QImage q = quantizeImg(ctx, img, r.mode);
+    r.delta_e = measure_quality(img, q).delta_e;
+    r.bytes = gif_bytes(q);
+    return r;
+}
+
+// scores every candidate on img, concurrently
+static void score_all(ThreadPool &pool, QImage const &img, std::vector<TuneResult> &rs,
+    std::vector<Palette> const &pals, std::vector<int> const &pal_of)
+{
+    std::vector<std::future<TuneResult>> jobs;
+    for( size_t i=0; i<rs.size(); ++i )
+        jobs.push_back(pool.submit([&, i]() { return score(img, rs[i], pals[pal_of[i]]); }));
+    for( size_t i=0; i<rs.size(); ++i )
+        rs[i] = jobs[i].get();
+}
+
+// keeps results that nothing beats in both error and size. idx follows along
+static void pareto(std::vector<TuneResult> &rs, std::vector<int> &idx)
+{
+    std::vector<int> order(rs.size());
+    for( size_t i=0; i<order.size(); ++i ) order[i] = i;
+    std::sort(order.begin(), order.end(), [&rs](int a, int b) {
+        if (rs[a].bytes != rs[b].bytes) return rs[a].bytes < rs[b].bytes;
+        return rs[a].delta_e < rs[b].delta_e;
+    });
+    std::vector<TuneResult> front;
+    std::vector<int> fi;
+    for( int i : order ) {
+        if (!front.empty() && rs[i].delta_e >= front.back().delta_e) continue;
+        front.push_back(rs[i]);
+        fi.push_back(idx[i]);
+    }
+    rs.swap(front);
+    idx.swap(fi);
+}
+
+std::vector<TuneResult> tune_dither(ThreadPool &pool, QImage const &img, TuneOptions const &opt)
+{
+    TRACE_SCOPE("tune_dither");
+    std::vector<TuneResult> rs;
+    if (img.isNull()) return rs;
+
+    // one palette per size, all from one LBG run. sizes past the number of
+    // distinct colors give the same palette
+    int k_max = opt.colors.empty() ? 1 : *std::max_element(opt.colors.begin(), opt.colors.end());
+    PaletteLadder ladder(Histogram(img, 5, QImage(), &pool), k_max);
+    std::vector<std::vector<uint32_t>> cols;
+    std::vector<Palette> pals;
+    for( int n : opt.colors ) {
+        auto const &c = ladder.get(n);
+        if (c.empty() || std::find(cols.begin(), cols.end(), c) != cols.end()) continue;
+        pals.push_back(Palette(c.data(), c.size()));
+        cols.push_back(c);
+    }
+
+    std::vector<int> pal_of;
+    for( size_t p=0; p<pals.size(); ++p )
+        for( int m=0; m<qfun_names.size(); ++m ) {
+            std::vector<int> fr {1024}, pp {0};
+            if (qfun_uses[m] & USES_ERR_FRACT) fr = opt.err_fracts;
+            if (qfun_uses[m] & USES_PINGPONG) pp = {0, 1};
+            for( int f : fr )
+                for( int q : pp ) {
+                    rs.push_back({m, f, q, cols[p], 0, 0});
+                    pal_of.push_back(p);
+                }
+        }
+
+    int s = opt.proxy_side;
+    bool small = img.width() <= s && img.height() <= s;
+    QImage proxy = small ? img : gscaled(img, s, s, Qt::KeepAspectRatio);
+    score_all(pool, proxy, rs, pals, pal_of);
+    TRACE_COUNT("tune candidates", (int64_t) rs.size());
+    pareto(rs, pal_of);
+    if (small) return rs;
+
+    // front-runners spread evenly along the proxy front
+    if ((int) rs.size() > opt.confirm && opt.confirm > 0) {
+        std::vector<TuneResult> keep;
+        std::vector<int> ki;
+        for( int i=0; i<opt.confirm; ++i ) {
+            int j = opt.confirm > 1 ? i * ( rs.size() - 1 ) / ( opt.confirm - 1 ) : 0;
+            keep.push_back(rs[j]);
+            ki.push_back(pal_of[j]);
+        }
+        rs.swap(keep);
+        pal_of.swap(ki);
+    }
+    score_all(pool, img, rs, pals, pal_of);
+    pareto(rs, pal_of);
+    return rs;
+}
@@ -0,0 +1,33 @@
+#ifndef TUNER_H
+#define TUNER_H
+#include <vector>
+#include <cstdint>
+#include <QImage>
+#include "threadpool.h"
+
+/*
+ * Searches dither method, error fraction, pingpong and palette size for
+ * one image. Every candidate is scored by its mean color error (CIE76 dE)
+ * and its size as GIF. Candidates are tried on a downscaled proxy first,
+ * the best of those are run again at full size. Palettes of all sizes
+ * come from one PaletteLadder over the histogram of the full image.
+ */
+struct TuneResult {
+    int mode, err_fract, pingpong;
+    std::vector<uint32_t> pal; // 0xRRGGBB
+    double delta_e;
+    long bytes;
+};
+
+struct TuneOptions {
+    std::vector<int> colors {4, 8, 16, 32, 64, 128, 256};
+    std::vector<int> err_fracts {1024, 922, 819, 717, 614}; // 100% .. 60%
+    int proxy_side = 256; // proxy fits in this square
+    int confirm = 10; // at most this many proxy results are run at full size
+};
+
+// the Pareto front at full size: no other result has both less error and
+// fewer bytes. sorted by size, smallest first
+std::vector<TuneResult> tune_dither(ThreadPool &pool, QImage const &img, TuneOptions const &opt=TuneOptions());
+
+#endif // TUNER_H
@@ -17,7 +17,7 @@ template<typename T> struct vec3 {
 auto operator+(vec3<T> a) { return vec3<T>(a.s[0]+s[0], a.s[1]+s[1], a.s[2]+s[2]); }
 auto operator-(vec3<T> a) { return vec3<T>(s[0]-a.s[0], s[1]-a.s[1], s[2]-a.s[2]); }
 auto operator*(vec3<T> a) { return vec3<T>(a.s[0]*s[0], a.s[1]*s[1], a.s[2]*s[2]); }
-auto operator/(vec3<T> a) { return vec3<T>(a.s[0]/s[0], a.s[1]/s[1], a.s[2]/s[2]); }
+auto operator/(vec3<T> a) { return vec3<T>(s[0]/a.s[0], s[1]/a.s[1], s[2]/a.s[2]); }
 
     void operator+=(vec3<T>a) { *this = *this + a; }
     void operator-=(vec3<T>a) { *this = *this - a; }
@@ -53,7 +53,166 @@ auto operator/(vec3<T> a) { return vec3<T>(a.s[0]/s[0], a.s[1]/s[1], a.s[2]/s[2]
     }
 };
 
+/*
+ * Four channel color, for RGBA. Only what the quantizers need
+ */
+template<typename T> struct vec4 {
+    T s[4];
+
+    vec4() {}
+    vec4(T x, T y, T z, T w) { s[0]=x; s[1]=y; s[2]=z; s[3]=w; }
+    vec4(T x) { s[0]=x; s[1]=x; s[2]=x; s[3]=x; }
+
+    vec4 operator+(vec4 a) const { return vec4(s[0]+a.s[0], s[1]+a.s[1], s[2]+a.s[2], s[3]+a.s[3]); }
+    vec4 operator-(vec4 a) const { return vec4(s[0]-a.s[0], s[1]-a.s[1], s[2]-a.s[2], s[3]-a.s[3]); }
+    vec4 operator*(T a) const { return vec4(s[0]*a, s[1]*a, s[2]*a, s[3]*a); }
+    vec4 operator>>(T i) const { return vec4(s[0]>>i, s[1]>>i, s[2]>>i, s[3]>>i); }
+
+    void operator+=(vec4 a) { *this = *this + a; }
+    void operator-=(vec4 a) { *this = *this - a; }
+
+    template<typename A>
+    A lensq() const { return (A)s[0]*s[0] + (A)s[1]*s[1] + (A)s[2]*s[2] + (A)s[3]*s[3]; }
+};
+
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+
+/*
+ * 4-lane SSE specializations with the same interface as above.
+ * The 4th lane is padding. it may hold garbage and is never read back.
+ * 16 byte stride lets arrays of these stay aligned.
+ */
+template<> struct vec3<int> {
+    union {
+        __m128i v;
+        int s[4];
+    };
+
+    vec3() {}
+    vec3(__m128i x) : v(x) {}
+    vec3(int x, int y, int z) : v(_mm_set_epi32(0, z, y, x)) {}
+    vec3(int x) : v(_mm_set_epi32(0, x, x, x)) {}
+
+    template<typename C>
+    vec3(C c) : vec3(c.red(), c.green(), c.blue()) {}
+
+    vec3 operator+(vec3 a) const { return _mm_add_epi32(v, a.v); }
+    vec3 operator-(vec3 a) const { return _mm_sub_epi32(v, a.v); }
+    vec3 operator*(vec3 a) const { return _mm_mullo_epi32(v, a.v); }
+    vec3 operator/(vec3 a) const { return vec3(s[0]/a.s[0], s[1]/a.s[1], s[2]/a.s[2]); }
+
+    void operator+=(vec3 a) { v = _mm_add_epi32(v, a.v); }
+    void operator-=(vec3 a) { v = _mm_sub_epi32(v, a.v); }
+    void operator*=(vec3 a) { v = _mm_mullo_epi32(v, a.v); }
+    void operator/=(vec3 a) { *this = *this / a; }
+
+    vec3 operator+(int a) const { return _mm_add_epi32(v, _mm_set1_epi32(a)); }
+    vec3 operator-(int a) const { return _mm_sub_epi32(v, _mm_set1_epi32(a)); }
+    vec3 operator*(int a) const { return _mm_mullo_epi32(v, _mm_set1_epi32(a)); }
+    vec3 operator/(int a) const { return vec3(s[0]/a, s[1]/a, s[2]/a); }
+
+    vec3 operator<<(int i) const { return _mm_sll_epi32(v, _mm_cvtsi32_si128(i)); }
+    vec3 operator>>(int i) const { return _mm_sra_epi32(v, _mm_cvtsi32_si128(i)); }
+    vec3 operator&(int i) const { return _mm_and_si128(v, _mm_set1_epi32(i)); }
+    vec3 operator^(int i) const { return _mm_xor_si128(v, _mm_set1_epi32(i)); }
+
+    vec3 step(int edge, int lo, int hi) const {
+        __m128i m = _mm_cmplt_epi32(v, _mm_set1_epi32(edge));
+        return _mm_blendv_epi8(_mm_set1_epi32(hi), _mm_set1_epi32(lo), m);
+    }
+
+    template<typename H>
+    vec3 lookup(H table[]) const { return vec3(table[s[0]], table[s[1]], table[s[2]]); }
+
+    // squares are summed in 64 bits
+    template<typename A>
+    A lensq() const {
+        __m128i x = _mm_blend_epi16(v, _mm_setzero_si128(), 0xc0);
+        __m128i y = _mm_srli_epi64(x, 32);
+        __m128i q = _mm_add_epi64(_mm_mul_epi32(x, x), _mm_mul_epi32(y, y));
+        q = _mm_add_epi64(q, _mm_unpackhi_epi64(q, q));
+        return (A) _mm_cvtsi128_si64(q);
+    }
+
+    template<typename F>
+    vec3 f(F f) const { return vec3(f(s[0]), f(s[1]), f(s[2])); }
+};
+
+template<> struct vec3<float> {
+    union {
+        __m128 v;
+        float s[4];
+    };
+
+    vec3() {}
+    vec3(__m128 x) : v(x) {}
+    vec3(float x, float y, float z) : v(_mm_set_ps(0, z, y, x)) {}
+    vec3(float x) : v(_mm_set_ps(0, x, x, x)) {}
+
+    template<typename C>
+    vec3(C c) : vec3(c.red(), c.green(), c.blue()) {}
+
+    vec3 operator+(vec3 a) const { return _mm_add_ps(v, a.v); }
+    vec3 operator-(vec3 a) const { return _mm_sub_ps(v, a.v); }
+    vec3 operator*(vec3 a) const { return _mm_mul_ps(v, a.v); }
+    vec3 operator/(vec3 a) const { return _mm_div_ps(v, a.v); }
+
+    void operator+=(vec3 a) { v = _mm_add_ps(v, a.v); }
+    void operator-=(vec3 a) { v = _mm_sub_ps(v, a.v); }
+    void operator*=(vec3 a) { v = _mm_mul_ps(v, a.v); }
+    void operator/=(vec3 a) { v = _mm_div_ps(v, a.v); }
+
+    vec3 operator+(float a) const { return _mm_add_ps(v, _mm_set1_ps(a)); }
+    vec3 operator-(float a) const { return _mm_sub_ps(v, _mm_set1_ps(a)); }
+    vec3 operator*(float a) const { return _mm_mul_ps(v, _mm_set1_ps(a)); }
+    vec3 operator/(float a) const { return _mm_div_ps(v, _mm_set1_ps(a)); }
+
+    vec3 step(float edge, float lo, float hi) const {
+        __m128 m = _mm_cmplt_ps(v, _mm_set1_ps(edge));
+        return _mm_blendv_ps(_mm_set1_ps(hi), _mm_set1_ps(lo), m);
+    }
+
+    template<typename A>
+    A lensq() const { return (A) _mm_cvtss_f32(_mm_dp_ps(v, v, 0x71)); }
+
+    template<typename F>
+    vec3 f(F f) const { return vec3(f(s[0]), f(s[1]), f(s[2])); }
+};
+
+// all 4 lanes used, so RGBA costs the same as RGB
+template<> struct vec4<int> {
+    union {
+        __m128i v;
+        int s[4];
+    };
+
+    vec4() {}
+    vec4(__m128i x) : v(x) {}
+    vec4(int x, int y, int z, int w) : v(_mm_set_epi32(w, z, y, x)) {}
+    vec4(int x) : v(_mm_set1_epi32(x)) {}
+
+    vec4 operator+(vec4 a) const { return _mm_add_epi32(v, a.v); }
+    vec4 operator-(vec4 a) const { return _mm_sub_epi32(v, a.v); }
+    vec4 operator*(int a) const { return _mm_mullo_epi32(v, _mm_set1_epi32(a)); }
+    vec4 operator>>(int i) const { return _mm_sra_epi32(v, _mm_cvtsi32_si128(i)); }
+
+    void operator+=(vec4 a) { v = _mm_add_epi32(v, a.v); }
+    void operator-=(vec4 a) { v = _mm_sub_epi32(v, a.v); }
+
+    template<typename A>
+    A lensq() const {
+        __m128i y = _mm_srli_epi64(v, 32);
+        __m128i q = _mm_add_epi64(_mm_mul_epi32(v, v), _mm_mul_epi32(y, y));
+        q = _mm_add_epi64(q, _mm_unpackhi_epi64(q, q));
+        return (A) _mm_cvtsi128_si64(q);
+    }
+};
+#endif // __SSE4_1__
+
 typedef vec3<int> ivec3;
+typedef vec3<float> fvec3;
+typedef vec4<int> ivec4;
 
 #endif // VEC3
 